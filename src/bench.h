@@ -1,6 +1,11 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
 #include <chrono>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include "engine.h"
 #include "misc.h"
 #include "movegen.h"
 #include "position.h"
@@ -49,23 +54,36 @@ namespace Nebula{
     "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
   };
 
-  inline std::vector<std::string> setupBench(){
-    std::vector<std::string> list;
-    std::string token;
-    std::string ttSize="16";
-    std::string threads="1";
-    const std::string limit="20";
-    std::string limitType="depth";
-    std::string go=limitType="go "+limitType+" "+limit;
-    const std::vector<std::string> fens=defaults;
-    size_t posCounter=0;
+  // Turns "bench [hash] [threads] [limit] [limitType] [fenFile]" into the
+  // list of UCI commands to run. fenFile is "default", "current" or a file
+  // with one FEN per line, limitType is depth, nodes or movetime.
+  inline std::vector<std::string> setupBench(const Position& current, std::istream& is){
+    std::vector<std::string> fens, list;
+    std::string ttSize="16", threads="1", limit="20", limitType="depth", fenFile="default";
+    is>>ttSize>>threads>>limit>>limitType>>fenFile;
+    if (fenFile=="default")
+      fens=defaults;
+    else if (fenFile=="current")
+      fens.emplace_back(current.fen());
+    else{
+      std::ifstream file(fenFile);
+      if (!file){
+        async()<<"info string unable to open "<<fenFile<<std::endl;
+        return list;
+      }
+      for (std::string fen; getline(file,fen);)
+        if (!fen.empty())
+          fens.emplace_back(fen);
+    }
+    list.emplace_back("setoption name Threads value "+threads);
+    list.emplace_back("setoption name Hash value "+ttSize);
+    list.emplace_back("ucinewgame");
     for (const std::string& fen : fens)
       if (fen.find("setoption")!=std::string::npos)
         list.emplace_back(fen);
       else{
         list.emplace_back("position fen "+fen);
-        list.emplace_back(go);
-        ++posCounter;
+        list.emplace_back("go "+limitType+" "+limit);
       }
     return list;
   }
@@ -75,13 +93,54 @@ namespace Nebula{
   inline uint64_t perftNanoseconds(const PerftClock::time_point& a,
     const PerftClock::time_point& b){ return std::chrono::duration_cast<std::chrono::nanoseconds>(b-a).count(); }
 
+  // Lock-free perft cache. An entry keeps its key xor-ed with the data next
+  // to the data itself, so a write torn by another thread fails the key
+  // check instead of handing back a wrong count.
+  class PerftTable{
+  public:
+    explicit PerftTable(const size_t mb){
+      size_t count=1;
+      while (2*count*sizeof(Entry)<=mb*1024*1024)
+        count*=2;
+      table=std::make_unique<Entry[]>(count);
+      mask=count-1;
+    }
+
+    bool probe(const uint64_t key, const Depth depth, uint64_t& nodes) const{
+      const Entry& e=table[key&mask];
+      const uint64_t data=e.data.load(std::memory_order_relaxed);
+      if ((e.check.load(std::memory_order_relaxed)^data)!=key||(data&0xFF)!=uint64_t(depth))
+        return false;
+      nodes=data>>8;
+      return true;
+    }
+
+    void store(const uint64_t key, const Depth depth, const uint64_t nodes){
+      Entry& e=table[key&mask];
+      const uint64_t data=nodes<<8|uint64_t(depth);
+      e.check.store(key^data,std::memory_order_relaxed);
+      e.data.store(data,std::memory_order_relaxed);
+    }
+
+  private:
+    struct Entry{
+      std::atomic<uint64_t> check, data;
+    };
+
+    std::unique_ptr<Entry[]> table;
+    size_t mask;
+  };
+
   template <bool Root>
-  uint64_t perft(Position& pos, const Depth depth){
+  uint64_t perft(Position& pos, const Depth depth, PerftTable* table=nullptr){
     StateInfo st;
 
     uint64_t cnt, nodes=0;
     const bool leaf=depth==2;
 
+    if (table&&depth>2&&table->probe(pos.key(),depth,nodes))
+      return nodes;
+
     for (const auto& m : MoveList<LEGAL>(pos)){
       if (Root&&depth<=1){
         cnt=1;
@@ -91,33 +150,67 @@ namespace Nebula{
         pos.doMove(m,st);
         cnt=leaf
             ?MoveList<LEGAL>(pos).size()
-            :perft<false>(pos,depth-1);
+            :perft<false>(pos,depth-1,table);
         nodes+=cnt;
         pos.undoMove(m);
       }
-
-      if (Root)
-        async()<<Uci::move(m,pos.isChess960())<<": "<<cnt<<std::endl;
     }
+
+    if (table&&depth>2)
+      table->store(pos.key(),depth,nodes);
     return nodes;
   }
 
-  inline uint64_t perft(Position& pos, const Depth depth){
+  // Splits the root moves over the threads of the pool. Every worker walks
+  // its own copy of the position and counts its nodes on its own Thread, so
+  // nothing is shared but the optional hash table. The per-move counts are
+  // printed once all workers are done.
+  inline uint64_t perft(Engine& engine, const Position& root, const Depth depth, const size_t hashMb=0){
+    engine.threads.main()->waitForSearchFinished();
+    const MoveList<LEGAL> moves(root);
+    const std::unique_ptr<PerftTable> table=hashMb?std::make_unique<PerftTable>(hashMb):nullptr;
+    std::vector<uint64_t> counts(moves.size());
+    std::atomic<size_t> next=0;
     const auto start=PerftClock::now();
-    const uint64_t nodes=perft<true>(pos,depth);
+    for (Thread* th : engine.threads)
+      th->runCustomJob([&,th]{
+        StateInfo rootSt, st;
+        Position pos;
+        pos.set(root.fen(),root.isChess960(),&rootSt,th);
+        for (size_t i; (i=next++)<moves.size();){
+          const Move m=moves.begin()[i];
+          if (depth<=1){
+            counts[i]=1;
+            continue;
+          }
+          pos.doMove(m,st);
+          counts[i]=depth==2
+                    ?MoveList<LEGAL>(pos).size()
+                    :perft<false>(pos,depth-1,table.get());
+          pos.undoMove(m);
+        }
+      });
+    for (Thread* th : engine.threads)
+      th->waitForSearchFinished();
     const auto end=PerftClock::now();
 
+    uint64_t nodes=0;
+    for (size_t i=0; i<moves.size(); ++i){
+      nodes+=counts[i];
+      async()<<Uci::move(moves.begin()[i],root.isChess960())<<": "<<counts[i]<<std::endl;
+    }
+
     const uint64_t elapsedNs=perftNanoseconds(start,end);
 
-    const uint64_t nps=elapsedNs>0
-                       ?nodes*1000000000ULL/elapsedNs
-                       :0;
+    const double mnps=elapsedNs>0
+                      ?static_cast<double>(nodes)*1000/elapsedNs
+                      :0;
 
     const double elapsedSec=static_cast<double>(elapsedNs)*1e-9;
 
     async()<<"\nNodes: "<<nodes<<std::endl;
     async()<<"Time:  "<<elapsedSec<<" sec"<<std::endl;
-    async()<<"Speed: "<<nps<<" N/s\n"<<std::endl;
+    async()<<"Speed: "<<mnps<<" Mnps ("<<engine.threads.size()<<" threads, hash "<<hashMb<<" MB)\n"<<std::endl;
 
     return nodes;
   }
@@ -13,6 +13,9 @@ namespace Nebula{
   uint64_t pawnAttacks[COLOR_NB][SQUARE_NB];
   Magic rookMagics[SQUARE_NB];
   Magic bishopMagics[SQUARE_NB];
+#ifdef USE_FAT
+  const bool hasPext=hostCpu().fastPext;
+#endif
 
   namespace{
     uint64_t rookTable[0x19000];
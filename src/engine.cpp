@@ -0,0 +1,35 @@
+#include <mutex>
+#include "bitboard.h"
+#include "engine.h"
+#include "evaluate.h"
+#include "misc.h"
+#include "numa.h"
+#include "position.h"
+
+namespace Nebula{
+  namespace{
+    std::once_flag sharedInit;
+  }
+
+  Engine::Engine(){
+    std::call_once(sharedInit,[]{
+      Bitboards::init();
+      Position::init();
+      Numa::init();
+      Eval::Nnue::init();
+    });
+    onPv=[](const Position& pos, const Depth depth){ async()<<Uci::pv(pos,depth)<<std::endl; };
+    onBestMove=[](const Position& pos, const Move best, const Move ponder){
+      async()<<"bestmove "<<Uci::move(best,pos.isChess960());
+      if (ponder)
+        async()<<" ponder "<<Uci::move(ponder,pos.isChess960());
+      async()<<std::endl;
+    };
+    onMessage=[](const std::string& message){ async()<<"info string "<<message<<std::endl; };
+    Uci::init(options,*this);
+    threads.set(std::max<size_t>(1,options["Threads"].asSize()));
+    Search::clear(*this);
+  }
+
+  Engine::~Engine(){ threads.set(0); }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <functional>
+#include <string>
+#include "search.h"
+#include "thread.h"
+#include "timeman.h"
+#include "tt.h"
+#include "uci.h"
+
+namespace Nebula{
+  // Everything a search mutates. The NNUE weights, Zobrist keys and
+  // attack tables are process wide and shared by all engines.
+  class Engine{
+  public:
+    Engine();
+    ~Engine();
+    Engine(const Engine&)=delete;
+    Engine& operator=(const Engine&)=delete;
+    Uci::OptionsMap options;
+    ThreadPool threads{*this};
+    TranspositionTable tt{threads};
+    TimeManagement time{*this};
+    Search::LimitsType limits;
+    // Search output, printed as UCI unless an embedder installs its own.
+    std::function<void(const Position& pos, Depth depth)> onPv;
+    std::function<void(const Position& pos, Move best, Move ponder)> onBestMove;
+    // Reports of the option handlers, printed as info strings by default
+    std::function<void(const std::string& message)> onMessage;
+  };
+}
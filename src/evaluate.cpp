@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <streambuf>
@@ -19,14 +20,20 @@ using namespace std;
 namespace Nebula{
   namespace Eval{
     string currentNnueNetName;
+    std::shared_mutex Nnue::networkMutex;
+    uint32_t Nnue::networkGeneration=0;
 
-    void Nnue::init(){
-      const string evalFile=NnueNetDefaultName;
-      for (const vector<string> dirs={"<internal>","",CommandLine::binaryDirectory}; const string& directory : dirs)
-        if (currentNnueNetName!=evalFile){
+    namespace{
+      vector<string> netDirs(){ return {"<internal>","",CommandLine::binaryDirectory}; }
+
+      // Reads evalFile from the first directory that has it, or the embedded
+      // network for the default name, and hands the stream to load
+      template<typename Load>
+      bool readNetwork(const string& evalFile, const Load& load){
+        for (const string& directory : netDirs()){
           if (directory!="<internal>"){
-            if (ifstream stream(directory+evalFile,ios::binary); loadEval(evalFile,stream))
-              currentNnueNetName=evalFile;
+            if (ifstream stream(directory+evalFile,ios::binary); load(evalFile,stream))
+              return true;
           }
           if (directory=="<internal>"&&evalFile==NnueNetDefaultName){
             class MemoryBuffer : public basic_streambuf<char>{
@@ -39,26 +46,135 @@ namespace Nebula{
             MemoryBuffer buffer(const_cast<char*>(reinterpret_cast<const char*>(gEmbeddedNNUEData)),
               gEmbeddedNNUESize);
             (void)gEmbeddedNNUEEnd;
-            if (istream stream(&buffer); loadEval(evalFile,stream))
-              currentNnueNetName=evalFile;
+            if (istream stream(&buffer); load(evalFile,stream))
+              return true;
           }
         }
+        return false;
+      }
+    }
+
+    bool Nnue::init(const string& evalFile){
+      if (currentNnueNetName!=evalFile)
+        ++networkGeneration;
+      // A mapped file is preferred even over the embedded network, it needs
+      // no copy and its pages are shared with the other processes
+      for (const string& directory : netDirs())
+        if (currentNnueNetName!=evalFile&&directory!="<internal>"&&loadMapped(directory+evalFile))
+          currentNnueNetName=evalFile;
+      if (currentNnueNetName!=evalFile&&readNetwork(evalFile,loadEval))
+        currentNnueNetName=evalFile;
+      return currentNnueNetName==evalFile;
+    }
+
+    // A mapped network is only readable by the target that wrote it, so the
+    // others need the original file next to it.
+    bool Nnue::loadInto(const Target& target){
+      return !currentNnueNetName.empty()&&readNetwork(currentNnueNetName,target.loadEval);
+    }
+  }
+
+#ifdef USE_FAT
+  namespace Eval::Nnue{
+    namespace{
+      const Target* pickTarget(){
+        const Cpu& cpu=hostCpu();
+        if (cpu.vnni512)
+          return cpu.fastZmm?&Targets::vnni512:&Targets::vnni256;
+        if (cpu.avx512)
+          return &Targets::avx512;
+        if (cpu.avxvnni)
+          return &Targets::avxvnni;
+        if (cpu.avx2)
+          return &Targets::avx2;
+        return &Targets::base;
+      }
+
+      const Target* const target=pickTarget();
+    }
+
+    Value evaluate(const Position& pos, const bool adjusted, int* complexity){
+      return target->evaluate(pos,adjusted,complexity);
+    }
+
+    void evaluate(const Position* const* pos, const size_t count, Value* out, const bool adjusted, int* complexity){
+      target->evaluateBatch(pos,count,out,adjusted,complexity);
+    }
+
+    void updateAccumulators(const Position& pos){ target->updateAccumulators(pos); }
+    void clearCache(AccumulatorCache& cache){ target->clearCache(cache); }
+    bool loadEval(const std::string& name, std::istream& stream){ return target->loadEval(name,stream); }
+    bool loadMapped(const std::string& path){ return target->loadMapped(path); }
+    bool exportMapped(const std::string& path){ return target->exportMapped(path); }
+    const char* targetName(){ return target->name(); }
+
+    vector<const Target*> targets(){
+      const Cpu& cpu=hostCpu();
+      const pair<const Target*, bool> all[]={
+        {&Targets::vnni512,cpu.vnni512},{&Targets::vnni256,cpu.vnni512},{&Targets::avx512,cpu.avx512},
+        {&Targets::avxvnni,cpu.avxvnni},{&Targets::avx2,cpu.avx2},{&Targets::base,true}
+      };
+      vector<const Target*> paths{target};
+      for (const auto& [t,runs] : all)
+        if (runs&&t!=target)
+          paths.push_back(t);
+      return paths;
     }
   }
+#else
+  vector<const Eval::Nnue::Target*> Eval::Nnue::targets(){ return {&Targets::native}; }
+#endif
 
+  namespace{
+    Value scaled(const Position& pos, const Value nnue, int nnueComplexity, int* complexity){
+      const Color stm=pos.stm();
+      const int scale=1064+106*pos.nonPawnMaterial()/5120;
+      Value optimism=pos.thisthread()->optimism[stm];
+      nnueComplexity=(104*nnueComplexity+131*abs(nnue))/256;
+      if (complexity)
+        *complexity=nnueComplexity;
+      optimism=optimism*(269+nnueComplexity)/256;
+      Value v=(nnue*scale+optimism*(scale-754))/1024;
+      v=v*(195-pos.rule50Count())/211;
+      v=std::clamp(v,VALUE_TB_LOSS_IN_MAX_PLY+1,VALUE_TB_WIN_IN_MAX_PLY-1);
+      return v;
+    }
+  }
+
+  void Eval::EvalCache::clear(const bool enable){
+    if (enable)
+      std::memset(buckets,0,sizeof(buckets));
+    probes=hits=0;
+    enabled=enable;
+  }
+
+  // A miss goes in front of its bucket and pushes out the oldest entry.
   Value Eval::evaluate(const Position& pos, int* complexity){
-    const Color stm=pos.stm();
+    EvalCache& cache=pos.thisthread()->evalCache;
+    if (!cache.enabled){
+      int nnueComplexity;
+      const Value nnue=Nnue::evaluate(pos,true,&nnueComplexity);
+      return scaled(pos,nnue,nnueComplexity,complexity);
+    }
+    const uint64_t key=pos.key();
+    EvalCache::Entry* const entry=cache.buckets[key&(EvalCache::bucketCount-1)].entry;
+    ++cache.probes;
+    for (int i=0; i<4; ++i)
+      if (entry[i].key==key){
+        ++cache.hits;
+        return scaled(pos,static_cast<Value>(entry[i].value),entry[i].complexity,complexity);
+      }
     int nnueComplexity;
-    const int scale=1064+106*pos.nonPawnMaterial()/5120;
-    Value optimism=pos.thisthread()->optimism[stm];
     const Value nnue=Nnue::evaluate(pos,true,&nnueComplexity);
-    nnueComplexity=(104*nnueComplexity+131*abs(nnue))/256;
-    if (complexity)
-      *complexity=nnueComplexity;
-    optimism=optimism*(269+nnueComplexity)/256;
-    Value v=(nnue*scale+optimism*(scale-754))/1024;
-    v=v*(195-pos.rule50Count())/211;
-    v=std::clamp(v,VALUE_TB_LOSS_IN_MAX_PLY+1,VALUE_TB_WIN_IN_MAX_PLY-1);
-    return v;
+    std::memmove(entry+1,entry,3*sizeof(EvalCache::Entry));
+    entry[0]={key,nnue,nnueComplexity};
+    return scaled(pos,nnue,nnueComplexity,complexity);
+  }
+
+  void Eval::evaluate(const Position* const* pos, const size_t count, Value* out){
+    vector<int> nnueComplexity(count);
+    Nnue::evaluate(pos,count,out,true,nnueComplexity.data());
+    for (size_t i=0; i<count; ++i)
+      out[i]=scaled(*pos[i],out[i],nnueComplexity[i],nullptr);
   }
 }
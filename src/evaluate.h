@@ -1,6 +1,8 @@
 #pragma once
 #include <string>
 #include <optional>
+#include <shared_mutex>
+#include <vector>
 #include "types.h"
 
 namespace Nebula{
@@ -8,15 +10,89 @@ namespace Nebula{
 
   namespace Eval{
     Value evaluate(const Position& pos, int* complexity=nullptr);
+
+    // Network output of the positions a thread evaluated last, so that
+    // transpositions the TT has dropped skip the network. Four entries share
+    // a cache line and a probe reads just that line. Off unless the EvalCache
+    // option is set, it takes effect with the next ucinewgame.
+    struct EvalCache{
+      struct Entry{
+        uint64_t key;
+        int32_t value, complexity;
+      };
+      struct alignas(64) Bucket{
+        Entry entry[4];
+      };
+      static constexpr size_t bucketCount=8192;
+      void clear(bool enable);
+      Bucket buckets[bucketCount];
+      uint64_t probes, hits;
+      bool enabled=false;
+    };
+    void evaluate(const Position* const* pos, size_t count, Value* out);
     extern std::string currentNnueNetName;
 #define NnueNetDefaultName   "1877415756.bin"
 
     namespace Nnue{
+      struct AccumulatorCache;
       Value evaluate(const Position& pos, bool adjusted=false, int* complexity=nullptr);
-      void init();
+      void evaluate(const Position* const* pos, size_t count, Value* out, bool adjusted=false,
+        int* complexity=nullptr);
+      // Brings the accumulators of pos up to date without propagating.
+      void updateAccumulators(const Position& pos);
+      bool init(const std::string& evalFile=NnueNetDefaultName);
+      // The network is shared by every engine of the process. Threads hold
+      // this shared while they evaluate, it is replaced only when taken
+      // exclusively.
+      extern std::shared_mutex networkMutex;
+      // Bumped by init whenever it loads a network, read and written under
+      // networkMutex. Threads compare it to drop caches of an older network.
+      extern uint32_t networkGeneration;
+      void clearCache(AccumulatorCache& cache);
       bool loadEval(const std::string& name, std::istream& stream);
+      // A network written by exportMapped is mapped read-only instead of
+      // copied, so processes using the same file share its pages. It only
+      // loads into the build and instruction set that wrote it.
+      bool loadMapped(const std::string& path);
+      bool exportMapped(const std::string& path);
       bool saveEval(std::ostream& stream);
       bool saveEval(const std::optional<std::string>& filename);
+      // Instruction set the network code runs with, picked at startup in fat
+      // builds and fixed by ARCH otherwise.
+      const char* targetName();
+      struct LayerTime{
+        const char* name;
+        double ns;
+      };
+
+      // One compiled copy of the network code with its own parameters. Fat
+      // builds have one per instruction set and pick one at startup, every
+      // build also has a scalar reference to check the others against.
+      struct Target{
+        const char* (*name)();
+        Value (*evaluate)(const Position& pos, bool adjusted, int* complexity);
+        void (*evaluateBatch)(const Position* const* pos, size_t count, Value* out, bool adjusted, int* complexity);
+        void (*updateAccumulators)(const Position& pos);
+        void (*clearCache)(AccumulatorCache& cache);
+        bool (*loadEval)(const std::string& name, std::istream& stream);
+        bool (*loadMapped)(const std::string& path);
+        bool (*exportMapped)(const std::string& path);
+        int (*benchLayers)(const Position& pos, int calls, LayerTime* out);
+      };
+
+      namespace Targets{
+        extern const Target scalar;
+#ifdef USE_FAT
+        extern const Target base, avx2, avxvnni, avx512, vnni256, vnni512;
+#else
+        extern const Target native;
+#endif
+      }
+
+      // The targets this CPU runs, the one in use first
+      std::vector<const Target*> targets();
+      // Loads the current network into a target other than the one in use
+      bool loadInto(const Target& target);
     }
   }
 }
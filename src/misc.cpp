@@ -1,10 +1,30 @@
+#include <algorithm>
 #include <iomanip>
+#include <map>
 #include <sstream>
 #include <vector>
+#include <cstddef>
 #include <cstdlib>
 #ifdef _WIN32
 #include <direct.h>
+#ifndef NOMINMAX
+#define NOMINMAX
 #endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__) && !defined(__ANDROID__)
+#define USE_HUGE_PAGES
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define USE_PERF_EVENTS
+#endif
+#include "evaluate.h"
 #include "misc.h"
 #include "thread.h"
 using namespace std;
@@ -19,12 +39,234 @@ namespace Nebula{
   string engineInfo(){
     stringstream ss;
     ss<<"id name "<<engine<<" "<<version<<std::endl;
-    ss<<"id author "<<author;
+    ss<<"id author "<<author<<std::endl;
+    ss<<"info string simd "<<Eval::Nnue::targetName()<<", magics "<<(hasPext?"pext":"multiply");
     return ss.str();
   }
 
-  void* alignedLargePagesAlloc(const size_t size){ return stdAlignedAlloc(alignof(std::max_align_t),size); }
-  void alignedLargePagesFree(void* mem){ stdAlignedFree(mem); }
+  const Cpu& hostCpu(){
+    static const Cpu cpu=[]{
+      Cpu c{};
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+      __builtin_cpu_init();
+      c.popcnt=__builtin_cpu_supports("popcnt");
+      c.sse41=__builtin_cpu_supports("sse4.1");
+      c.avx2=__builtin_cpu_supports("avx2");
+      c.bmi2=__builtin_cpu_supports("bmi2");
+      c.avxvnni=c.avx2&&__builtin_cpu_supports("avxvnni");
+      c.avx512=c.avx2&&__builtin_cpu_supports("avx512f")&&__builtin_cpu_supports("avx512bw");
+      c.vnni512=c.avx512&&__builtin_cpu_supports("avx512dq")&&__builtin_cpu_supports("avx512vl")
+        &&__builtin_cpu_supports("avx512vnni");
+      // Zen 1 and 2 run pext in microcode, plain magics are faster there
+      c.fastPext=c.bmi2&&!__builtin_cpu_is("znver1")&&!__builtin_cpu_is("znver2");
+      // Cascade Lake drops its clock on 512-bit code, 256-bit vnni wins there
+      c.fastZmm=c.avx512&&!__builtin_cpu_is("cascadelake");
+#endif
+      return c;
+    }();
+    return cpu;
+  }
+
+  namespace{
+    constexpr size_t largePageSize=2*1024*1024;
+#ifdef USE_HUGE_PAGES
+    std::mutex mappingsMutex;
+    std::map<void*, size_t> hugeTlbMappings;
+#endif
+  }
+
+  void* alignedLargePagesAlloc(const size_t size, PageMode* mode){
+    const size_t allocSize=(size+largePageSize-1)/largePageSize*largePageSize;
+    PageMode used=PageMode::Default;
+#ifdef USE_HUGE_PAGES
+    if (void* mem=mmap(nullptr,allocSize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+      mem!=MAP_FAILED){
+      std::scoped_lock lk(mappingsMutex);
+      hugeTlbMappings[mem]=allocSize;
+      if (mode)
+        *mode=PageMode::HugeTlb;
+      return mem;
+    }
+#endif
+    void* mem=stdAlignedAlloc(largePageSize,allocSize);
+#if defined(USE_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+    if (mem&&!madvise(mem,allocSize,MADV_HUGEPAGE))
+      used=PageMode::Transparent;
+#endif
+    if (mode)
+      *mode=used;
+    return mem;
+  }
+
+  void alignedLargePagesFree(void* mem){
+    if (!mem)
+      return;
+#ifdef USE_HUGE_PAGES
+    {
+      std::scoped_lock lk(mappingsMutex);
+      if (const auto it=hugeTlbMappings.find(mem); it!=hugeTlbMappings.end()){
+        munmap(it->first,it->second);
+        hugeTlbMappings.erase(it);
+        return;
+      }
+    }
+#endif
+    stdAlignedFree(mem);
+  }
+
+  void discardLargePages(void* mem, const size_t size){
+#ifdef USE_HUGE_PAGES
+    const uintptr_t begin=(reinterpret_cast<uintptr_t>(mem)+largePageSize-1)&~(largePageSize-1);
+    const uintptr_t end=(reinterpret_cast<uintptr_t>(mem)+size+largePageSize-1)&~(largePageSize-1);
+    if (end>begin)
+      madvise(reinterpret_cast<void*>(begin),end-begin,MADV_DONTNEED);
+#else
+    (void)mem;
+    (void)size;
+#endif
+  }
+
+  bool MappedFile::open(const string& path){
+    close();
+#ifdef _WIN32
+    const HANDLE file=CreateFileA(path.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL,nullptr);
+    if (file==INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file,&fileSize)&&fileSize.QuadPart>0)
+      mapping=CreateFileMappingA(file,nullptr,PAGE_READONLY,0,0,nullptr);
+    CloseHandle(file);
+    if (!mapping)
+      return false;
+    data_=static_cast<const char*>(MapViewOfFile(mapping,FILE_MAP_READ,0,0,0));
+    if (!data_){
+      CloseHandle(mapping);
+      mapping=nullptr;
+      return false;
+    }
+    size_=static_cast<size_t>(fileSize.QuadPart);
+#else
+    const int fd=::open(path.c_str(),O_RDONLY);
+    if (fd<0)
+      return false;
+    struct stat st{};
+    void* mem=MAP_FAILED;
+    if (!fstat(fd,&st)&&st.st_size>0)
+      mem=mmap(nullptr,static_cast<size_t>(st.st_size),PROT_READ,MAP_SHARED,fd,0);
+    ::close(fd);
+    if (mem==MAP_FAILED)
+      return false;
+    data_=static_cast<const char*>(mem);
+    size_=static_cast<size_t>(st.st_size);
+#endif
+    return true;
+  }
+
+  void MappedFile::close(){
+    if (!data_)
+      return;
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping);
+    mapping=nullptr;
+#else
+    munmap(const_cast<char*>(data_),size_);
+#endif
+    data_=nullptr;
+    size_=0;
+  }
+
+  PerfCounters::PerfCounters([[maybe_unused]] const int threadId){
+    std::fill_n(fd,EventNb,-1);
+#ifdef USE_PERF_EVENTS
+    constexpr uint64_t cacheMiss=PERF_COUNT_HW_CACHE_OP_READ<<8|PERF_COUNT_HW_CACHE_RESULT_MISS<<16;
+    constexpr std::pair<uint32_t, uint64_t> events[EventNb]={
+      {PERF_TYPE_HARDWARE,PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE,PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HW_CACHE,PERF_COUNT_HW_CACHE_L1D|cacheMiss},
+      {PERF_TYPE_HARDWARE,PERF_COUNT_HW_CACHE_MISSES},
+      {PERF_TYPE_HW_CACHE,PERF_COUNT_HW_CACHE_DTLB|cacheMiss},
+      {PERF_TYPE_HARDWARE,PERF_COUNT_HW_BRANCH_MISSES}
+    };
+    for (int e=0; e<EventNb; ++e){
+      perf_event_attr attr{};
+      attr.size=sizeof(attr);
+      attr.type=events[e].first;
+      attr.config=events[e].second;
+      attr.disabled=e==Cycles;
+      attr.exclude_kernel=1;
+      attr.exclude_hv=1;
+      attr.read_format=PERF_FORMAT_GROUP|PERF_FORMAT_ID|PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fd[e]=static_cast<int>(syscall(SYS_perf_event_open,&attr,threadId,-1,fd[Cycles],0));
+      if (fd[e]>=0&&ioctl(fd[e],PERF_EVENT_IOC_ID,&id[e])){
+        ::close(fd[e]);
+        fd[e]=-1;
+      }
+      if (e==Cycles&&fd[e]<0)
+        return;
+    }
+#endif
+  }
+
+  PerfCounters::~PerfCounters(){
+#ifdef USE_PERF_EVENTS
+    for (const int f : fd)
+      if (f>=0)
+        ::close(f);
+#endif
+  }
+
+  void PerfCounters::start() const{
+#ifdef USE_PERF_EVENTS
+    if (available()){
+      ioctl(fd[Cycles],PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+      ioctl(fd[Cycles],PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+
+  void PerfCounters::stop([[maybe_unused]] uint64_t* values) const{
+#ifdef USE_PERF_EVENTS
+    if (!available())
+      return;
+    ioctl(fd[Cycles],PERF_EVENT_IOC_DISABLE,PERF_IOC_FLAG_GROUP);
+    // nr, time enabled, time running, then an id and value per event. Counts
+    // are scaled up when the kernel had to multiplex the group.
+    uint64_t buf[3+2*EventNb];
+    if (read(fd[Cycles],buf,sizeof(buf))<static_cast<ssize_t>(3*sizeof(uint64_t))||!buf[2])
+      return;
+    const double scale=static_cast<double>(buf[1])/static_cast<double>(buf[2]);
+    for (uint64_t i=0; i<std::min<uint64_t>(buf[0],EventNb); ++i)
+      for (int e=0; e<EventNb; ++e)
+        if (fd[e]>=0&&id[e]==buf[4+2*i])
+          values[e]+=static_cast<uint64_t>(static_cast<double>(buf[3+2*i])*scale);
+#endif
+  }
+
+  const char* PerfCounters::name(const Event e){
+    constexpr const char* names[EventNb]={"cycles","instructions","l1dMisses","llcMisses","dtlbMisses","branchMisses"};
+    return names[e];
+  }
+
+  int osThreadId(){
+#ifdef USE_PERF_EVENTS
+    return static_cast<int>(syscall(SYS_gettid));
+#else
+    return 0;
+#endif
+  }
+
+  string pageModeName(const PageMode mode){
+    switch (mode){
+    case PageMode::HugeTlb:
+      return "hugetlbfs pages";
+    case PageMode::Transparent:
+      return "transparent huge pages";
+    default:
+      return "default pages";
+    }
+  }
 
   void* stdAlignedAlloc(size_t alignment, size_t size){
 #ifdef _WIN32
@@ -47,6 +47,15 @@ namespace Nebula{
   };
 
   std::string engineInfo();
+
+  // Instruction set extensions of the host, as reported by cpuid and enabled
+  // by the OS. Fat builds pick their code paths from it.
+  struct Cpu{
+    bool popcnt, sse41, avx2, bmi2, avxvnni, avx512, vnni512;
+    bool fastPext, fastZmm;
+  };
+
+  const Cpu& hostCpu();
   void* stdAlignedAlloc(size_t alignment, size_t size);
   void stdAlignedFree(void* ptr);
   using TimePoint = std::chrono::milliseconds::rep;
@@ -94,6 +103,8 @@ namespace Nebula{
   public:
     [[nodiscard]] std::size_t size() const{ return size_; }
     void pushBack(const T& value){ values_[size_++]=value; }
+    void erase(const std::size_t i){ values_[i]=values_[--size_]; }
+    const T& operator[](const std::size_t i) const{ return values_[i]; }
     const T* begin() const{ return values_; }
     const T* end() const{ return values_+size_; }
   private:
@@ -141,6 +152,55 @@ namespace Nebula{
     extern std::string workingDirectory;
   }
 
-  void* alignedLargePagesAlloc(size_t size);
+  enum class PageMode :uint8_t{ Default, Transparent, HugeTlb };
+
+  // Read-only mapping of a whole file. The pages come from the page cache, so
+  // every process mapping the same file shares them.
+  class MappedFile{
+  public:
+    MappedFile()=default;
+    MappedFile(const MappedFile&)=delete;
+    MappedFile& operator=(const MappedFile&)=delete;
+    ~MappedFile(){ close(); }
+    bool open(const std::string& path);
+    void close();
+    [[nodiscard]] const char* data() const{ return data_; }
+    [[nodiscard]] size_t size() const{ return size_; }
+  private:
+    const char* data_=nullptr;
+    size_t size_=0;
+#ifdef _WIN32
+    void* mapping=nullptr;
+#endif
+  };
+
+  // Hardware counters of one thread, opened as a perf_event group on Linux
+  // and counting user space only. Events the CPU lacks read as zero. Without
+  // perf_event (other systems, a VM without a PMU, perf_event_paranoid) the
+  // group is not available and nothing is counted.
+  class PerfCounters{
+  public:
+    enum Event{ Cycles, Instructions, L1dMisses, LlcMisses, DtlbMisses, BranchMisses, EventNb };
+    explicit PerfCounters(int threadId=0);
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&)=delete;
+    PerfCounters& operator=(const PerfCounters&)=delete;
+    [[nodiscard]] bool available() const{ return fd[Cycles]>=0; }
+    void start() const;
+    // Stops counting and adds the counts since start() to values.
+    void stop(uint64_t* values) const;
+    static const char* name(Event e);
+  private:
+    int fd[EventNb];
+    uint64_t id[EventNb];
+  };
+
+  // Kernel id of the calling thread, what PerfCounters takes to count another
+  // thread. Zero where there is no such id.
+  int osThreadId();
+
+  void* alignedLargePagesAlloc(size_t size, PageMode* mode=nullptr);
   void alignedLargePagesFree(void* mem);
+  void discardLargePages(void* mem, size_t size);
+  std::string pageModeName(PageMode mode);
 }
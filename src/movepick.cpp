@@ -9,6 +9,7 @@ namespace Nebula{
       PROBCUT_TT, PROBCUT_INIT, PROBCUT,
       QSEARCH_TT, QCAPTURE_INIT, QCAPTURE, QCHECK_INIT, QCHECK
     };
+    static_assert(QCHECK+1==MovePicker::stageCount);
 
     void partialInsertionSort(ExtMove* begin, const ExtMove* end, const int limit){
       for (ExtMove *sortedEnd=begin, *p=begin+1; p<end; ++p)
@@ -22,6 +23,16 @@ namespace Nebula{
     }
   }
 
+  const char* MovePicker::stageName(const int s){
+    constexpr const char* names[stageCount]={
+      "main_tt","capture_init","good_capture","refutation","quiet_init","quiet","bad_capture",
+      "evasion_tt","evasion_init","evasion",
+      "probcut_tt","probcut_init","probcut",
+      "qsearch_tt","qcapture_init","qcapture","qcheck_init","qcheck"
+    };
+    return names[s];
+  }
+
   MovePicker::MovePicker(const Position& p, const Move ttm, const Depth d, const ButterflyHistory* mh,
     const CapturePieceToHistory* cph,
     const PieceToHistory** ch,
@@ -64,6 +64,9 @@ namespace Nebula{
       Square);
     MovePicker(const Position&, Move, Value, Depth, const CapturePieceToHistory*);
     Move nextMove(bool skipQuiets=false);
+    [[nodiscard]] int stageReached() const{ return stage; }
+    static const char* stageName(int s);
+    static constexpr int stageCount=18;
   private:
     template <PickType T, typename Pred>
     Move select(Pred);
@@ -1,17 +1,74 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <iomanip>
+#include <memory>
+#include <vector>
 #include "../evaluate.h"
 #include "../position.h"
 #include "../misc.h"
+#include "../thread.h"
 #include "../types.h"
+// Everything above keeps the baseline code generation of the build. In a fat
+// build only the network code below is compiled for the wider instruction
+// set, so the engine headers it inlines stay safe to run on any CPU.
+#if defined(NNUE_TARGET) && defined(USE_AVX2)
+#if defined(USE_AVXVNNI)
+#define NNUE_TARGET_ISA "avx2,bmi2,fma,avxvnni"
+#elif defined(USE_VNNI)
+#define NNUE_TARGET_ISA "avx2,bmi2,fma,avx512f,avx512bw,avx512dq,avx512vl,avx512vnni"
+#elif defined(USE_AVX512)
+#define NNUE_TARGET_ISA "avx2,bmi2,fma,avx512f,avx512bw"
+#else
+#define NNUE_TARGET_ISA "avx2,bmi2,fma"
+#endif
+#define NNUE_PRAGMA(x) _Pragma(#x)
+#ifdef __clang__
+#define NNUE_PUSH_TARGET(isa) NNUE_PRAGMA(clang attribute push(__attribute__((target(isa))), apply_to=function))
+#else
+#define NNUE_PUSH_TARGET(isa) NNUE_PRAGMA(GCC push_options) NNUE_PRAGMA(GCC target(isa))
+#endif
+NNUE_PUSH_TARGET(NNUE_TARGET_ISA)
+#endif
 #include "evaluate_nnue.h"
 
-namespace Nebula::Eval::Nnue{
+namespace NNUE_NAMESPACE{
   namespace{
-    LargePagePtr<FeatureTransformer> featureTransformer;
-    AlignedPtr<Network> network[layerStacks];
+    // The parameters in use, either owned or pointing into a mapped file
+    const FeatureTransformer* featureTransformer=nullptr;
+    const Network* network[layerStacks]={};
+    LargePagePtr<FeatureTransformer> ownedTransformer;
+    AlignedPtr<Network> ownedNetwork[layerStacks];
+    std::unique_ptr<MappedFile> mappedFile;
     std::string fileName;
     std::string netDescription;
 
+    // A mapped network starts with this header and the description, then
+    // has the in-memory images of the transformer and of every layer stack
+    // at page and cache line aligned offsets. The images carry the weight
+    // order of the instruction set that wrote them, so target must match.
+    struct MappedHeader{
+      std::uint64_t magic;
+      std::uint32_t version;
+      std::uint32_t hash;
+      char target[16];
+      std::uint64_t transformerSize;
+      std::uint64_t networkSize;
+      std::uint64_t transformerOffset;
+      std::uint32_t descriptionSize;
+      std::uint32_t layout;
+    };
+
+    constexpr std::uint64_t mappedMagic=0x50414d4e4b465353ull;
+    constexpr std::size_t pageSize=4096;
+#ifdef USE_SPARSE_FC0
+    constexpr std::uint32_t mappedLayout=1;  // fc_0 weights are stored in the sparse order
+#else
+    constexpr std::uint32_t mappedLayout=0;
+#endif
+    constexpr std::size_t transformerSpan=ceilToMultiple(sizeof(FeatureTransformer),cacheLineSize);
+
     namespace Detail{
       template <typename T>
       void initialize(AlignedPtr<T>& pointer){
@@ -35,11 +92,18 @@ namespace Nebula::Eval::Nnue{
     }
 
     void initialize(){
-      Detail::initialize(featureTransformer);
-      for (auto& i : network)
+      Detail::initialize(ownedTransformer);
+      for (auto& i : ownedNetwork)
         Detail::initialize(i);
     }
 
+    void useOwned(){
+      mappedFile.reset();
+      featureTransformer=ownedTransformer.get();
+      for (IndexType i=0; i<layerStacks; ++i)
+        network[i]=ownedNetwork[i].get();
+    }
+
     bool readHeader(std::istream& stream, std::uint32_t* value, std::string* desc){
       const auto version=readLittleEndian<std::uint32_t>(stream);
       *value=readLittleEndian<std::uint32_t>(stream);
@@ -54,16 +118,27 @@ namespace Nebula::Eval::Nnue{
       std::uint32_t value;
       if (!readHeader(stream,&value,&netDescription)) return false;
       if (value!=hashValue) return false;
-      if (!Detail::readParameters(stream,*featureTransformer)) return false;
-      for (auto& i : network)
+      if (!Detail::readParameters(stream,*ownedTransformer)) return false;
+      for (auto& i : ownedNetwork)
         if (!Detail::readParameters(stream,*i)) return false;
       return stream&&stream.peek()==std::ios::traits_type::eof();
     }
+
+    Value blend(const Position& pos, const std::int32_t psqt, const std::int32_t positional, const bool adjusted,
+      int* complexity){
+      const int delta=24-pos.nonPawnMaterial()/9560;
+      if (complexity)
+        *complexity=abs(psqt-positional)/outputScale;
+      if (adjusted)
+        return static_cast<Value>(((1024-delta)*psqt+(1024+delta)*positional)/(1024*outputScale));
+      return static_cast<Value>((psqt+positional)/outputScale);
+    }
+
+    int bucketOf(const Position& pos){ return (pos.count<ALL_PIECES>()-1)/4; }
   }
 
   Value evaluate(const Position& pos, const bool adjusted, int* complexity){
     constexpr uint64_t alignment=cacheLineSize;
-    const int delta=24-pos.nonPawnMaterial()/9560;
 #ifdef ALIGNAS_ON_STACK_VARIABLES_BROKEN
     TransformedFeatureType transformedFeaturesUnaligned[
       FeatureTransformer::BufferSize+alignment/sizeof(TransformedFeatureType)];
@@ -72,19 +147,215 @@ namespace Nebula::Eval::Nnue{
     alignas(alignment)
       TransformedFeatureType transformedFeatures[FeatureTransformer::BufferSize];
 #endif
-    const int bucket=(pos.count<ALL_PIECES>()-1)/4;
-    const auto psqt=featureTransformer->transform(pos,transformedFeatures,bucket);
+    const int bucket=bucketOf(pos);
+    const auto psqt=featureTransformer->transform(pos,pos.thisthread()->accumulators,pos.thisthread()->refreshTable,
+      transformedFeatures,bucket);
     const auto positional=network[bucket]->propagate(transformedFeatures);
-    if (complexity)
-      *complexity=abs(psqt-positional)/outputScale;
-    if (adjusted)
-      return static_cast<Value>(((1024-delta)*psqt+(1024+delta)*positional)/(1024*outputScale));
-    return static_cast<Value>((psqt+positional)/outputScale);
+    return blend(pos,psqt,positional,adjusted,complexity);
+  }
+
+  void updateAccumulators(const Position& pos){
+    featureTransformer->updateAccumulators(pos,pos.thisthread()->accumulators,pos.thisthread()->refreshTable);
+  }
+
+  // The positions are sorted by layer stack and king squares, so neighbours
+  // share weight columns, then refreshed and pushed through the network
+  // maxBatchSize at a time. The accumulators are rebuilt
+  // in a per-thread buffer rather than on the accumulator stack, which
+  // keeps them in cache and leaves the positions untouched.
+  void evaluate(const Position* const* pos, const std::size_t count, Value* out, const bool adjusted,
+    int* complexity){
+    struct alignas(cacheLineSize) Buffer{
+      Accumulator accumulators[maxBatchSize];
+      alignas(cacheLineSize) TransformedFeatureType transformed[maxBatchSize][FeatureTransformer::BufferSize];
+    };
+    alignas(cacheLineSize) thread_local Buffer buffer;
+    std::vector<std::pair<int, std::size_t>> order(count);
+    for (std::size_t i=0; i<count; ++i)
+      order[i]={(bucketOf(*pos[i])*SQUARE_NB+pos[i]->square<KING>(WHITE))*SQUARE_NB+pos[i]->square<KING>(BLACK),i};
+    std::sort(order.begin(),order.end());
+    for (std::size_t start=0; start<count; start+=maxBatchSize){
+      const std::size_t n=std::min<std::size_t>(count-start,maxBatchSize);
+      const Position* batch[maxBatchSize];
+      std::int32_t psqt[maxBatchSize], positional[maxBatchSize];
+      for (std::size_t i=0; i<n; ++i)
+        batch[i]=pos[order[start+i].second];
+      featureTransformer->refreshBatch(batch,n,buffer.accumulators);
+      for (std::size_t i=0; i<n; ++i)
+        psqt[i]=featureTransformer->transform(buffer.accumulators[i],batch[i]->stm(),buffer.transformed[i],
+          bucketOf(*batch[i]));
+      for (std::size_t i=0, j; i<n; i=j){
+        const int bucket=bucketOf(*batch[i]);
+        for (j=i+1; j<n&&bucketOf(*batch[j])==bucket; ++j){}
+        network[bucket]->propagate(buffer.transformed[i],static_cast<IndexType>(j-i),positional+i);
+      }
+      for (std::size_t i=0; i<n; ++i){
+        const std::size_t k=order[start+i].second;
+        out[k]=blend(*batch[i],psqt[i],positional[i],adjusted,complexity?complexity+k:nullptr);
+      }
+    }
   }
 
+  void clearCache(AccumulatorCache& cache){ featureTransformer->clearCache(cache); }
+
+  // Runs every layer of the stack of pos alone on the transformed features
+  // of pos, calls times each, then the whole stack. The signal fences keep
+  // the compiler from merging the identical calls.
+  int benchLayers(const Position& pos, const int calls, LayerTime* out){
+    struct alignas(cacheLineSize) Buffer{
+      Accumulator accumulator;
+      alignas(cacheLineSize) TransformedFeatureType transformed[FeatureTransformer::BufferSize];
+      alignas(cacheLineSize) decltype(Network::fc_0)::OutputBuffer fc_0_out;
+      alignas(cacheLineSize) decltype(Network::ac_sqr_0)::OutputType ac_sqr_0_out[ceilToMultiple<IndexType>(
+        Network::FC_0_OUTPUTS*2,32)];
+      alignas(cacheLineSize) decltype(Network::ac_0)::OutputBuffer ac_0_out;
+      alignas(cacheLineSize) decltype(Network::fc_1)::OutputBuffer fc_1_out;
+      alignas(cacheLineSize) decltype(Network::ac_1)::OutputBuffer ac_1_out;
+      alignas(cacheLineSize) decltype(Network::fc_2)::OutputBuffer fc_2_out;
+    };
+    alignas(cacheLineSize) thread_local Buffer b;
+    const int bucket=bucketOf(pos);
+    const Network& net=*network[bucket];
+    const Position* batch[]={&pos};
+    featureTransformer->refreshBatch(batch,1,&b.accumulator);
+    featureTransformer->transform(b.accumulator,pos.stm(),b.transformed,bucket);
+    int n=0;
+    const auto time=[&](const char* name, const auto& propagate){
+      const auto start=std::chrono::steady_clock::now();
+      for (int i=0; i<calls; ++i){
+        propagate();
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+      }
+      const auto ns=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start);
+      out[n++]={name,double(ns.count())/std::max(calls,1)};
+    };
+    time("fc_0",[&]{ net.fc_0.propagate(b.transformed,b.fc_0_out); });
+    time("ac_sqr_0",[&]{ net.ac_sqr_0.propagate(b.fc_0_out,b.ac_sqr_0_out); });
+    time("ac_0",[&]{ net.ac_0.propagate(b.fc_0_out,b.ac_0_out); });
+    std::memcpy(b.ac_sqr_0_out+Network::FC_0_OUTPUTS,b.ac_0_out,
+      Network::FC_0_OUTPUTS*sizeof(decltype(Network::ac_0)::OutputType));
+    time("fc_1",[&]{ net.fc_1.propagate(b.ac_sqr_0_out,b.fc_1_out); });
+    time("ac_1",[&]{ net.ac_1.propagate(b.fc_1_out,b.ac_1_out); });
+    time("fc_2",[&]{ net.fc_2.propagate(b.ac_1_out,b.fc_2_out); });
+    time("network",[&]{ b.fc_2_out[0]=net.propagate(b.transformed); });
+    return n;
+  }
+
+  const char* targetName(){
+#if defined(USE_AVX512) && defined(USE_VNNI)
+    return "vnni512";
+#elif defined(USE_AVX512)
+    return "avx512";
+#elif defined(USE_AVXVNNI)
+    return "avxvnni";
+#elif defined(USE_VNNI)
+    return "vnni256";
+#elif defined(USE_AVX2)
+    return "avx2";
+#elif defined(USE_SSE41)
+    return "sse41";
+#elif defined(USE_SSSE3)
+    return "ssse3";
+#elif defined(USE_SSE2)
+    return "sse2";
+#elif defined(USE_MMX)
+    return "mmx";
+#elif defined(USE_NEON)
+    return "neon";
+#else
+    return "generic";
+#endif
+  }
+
+  // Parameters of a failed load are garbage, they are still used if there
+  // was no network before so the engine keeps running.
   bool loadEval(const std::string& name, std::istream& stream){
+    const bool loaded=featureTransformer!=nullptr;
+    if (!stream&&loaded)
+      return false;
+    LargePagePtr<FeatureTransformer> prevTransformer=std::move(ownedTransformer);
+    AlignedPtr<Network> prevNetwork[layerStacks];
+    std::ranges::move(ownedNetwork,prevNetwork);
     initialize();
+    const bool ok=readParameters(stream);
+    if (!ok&&loaded){
+      ownedTransformer=std::move(prevTransformer);
+      std::ranges::move(prevNetwork,ownedNetwork);
+      return false;
+    }
     fileName=name;
-    return readParameters(stream);
+    useOwned();
+    return ok;
+  }
+
+  bool loadMapped(const std::string& path){
+    auto file=std::make_unique<MappedFile>();
+    MappedHeader h;
+    if (!file->open(path)||file->size()<sizeof(h))
+      return false;
+    std::memcpy(&h,file->data(),sizeof(h));
+    if (h.magic!=mappedMagic||h.version!=nnueVersion||h.hash!=hashValue
+      ||std::strncmp(h.target,targetName(),sizeof(h.target))||h.layout!=mappedLayout
+      ||h.transformerSize!=sizeof(FeatureTransformer)||h.networkSize!=sizeof(Network)
+      ||h.transformerOffset%pageSize||h.transformerOffset<sizeof(h)+h.descriptionSize
+      ||file->size()<h.transformerOffset+transformerSpan+layerStacks*sizeof(Network))
+      return false;
+    const char* params=file->data()+h.transformerOffset;
+    featureTransformer=reinterpret_cast<const FeatureTransformer*>(params);
+    for (IndexType i=0; i<layerStacks; ++i)
+      network[i]=reinterpret_cast<const Network*>(params+transformerSpan+i*sizeof(Network));
+    netDescription.assign(file->data()+sizeof(h),h.descriptionSize);
+    fileName=path;
+    ownedTransformer.reset();
+    for (auto& i : ownedNetwork)
+      i.reset();
+    mappedFile=std::move(file);
+    return true;
   }
+
+  bool exportMapped(const std::string& path){
+    if (!featureTransformer)
+      return false;
+    MappedHeader h{};
+    h.magic=mappedMagic;
+    h.version=nnueVersion;
+    h.hash=hashValue;
+    std::strncpy(h.target,targetName(),sizeof(h.target)-1);
+    h.transformerSize=sizeof(FeatureTransformer);
+    h.networkSize=sizeof(Network);
+    h.layout=mappedLayout;
+    h.descriptionSize=static_cast<std::uint32_t>(netDescription.size());
+    h.transformerOffset=ceilToMultiple(sizeof(h)+netDescription.size(),pageSize);
+    std::ofstream stream(path,std::ios::binary);
+    const std::vector<char> zeros(pageSize);
+    stream.write(reinterpret_cast<const char*>(&h),sizeof(h));
+    stream.write(netDescription.data(),static_cast<std::streamsize>(netDescription.size()));
+    stream.write(zeros.data(),static_cast<std::streamsize>(h.transformerOffset-sizeof(h)-netDescription.size()));
+    stream.write(reinterpret_cast<const char*>(featureTransformer),sizeof(FeatureTransformer));
+    stream.write(zeros.data(),static_cast<std::streamsize>(transformerSpan-sizeof(FeatureTransformer)));
+    for (const Network* n : network)
+      stream.write(reinterpret_cast<const char*>(n),sizeof(Network));
+    return !stream.fail();
+  }
+}
+#ifdef NNUE_TARGET_ISA
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
+
+namespace Nebula::Eval::Nnue{
+#ifdef NNUE_TARGET
+  const Target Targets::NNUE_TARGET{
+    NNUE_TARGET::targetName,NNUE_TARGET::evaluate,NNUE_TARGET::evaluate,NNUE_TARGET::updateAccumulators,
+    NNUE_TARGET::clearCache,NNUE_TARGET::loadEval,NNUE_TARGET::loadMapped,NNUE_TARGET::exportMapped,
+    NNUE_TARGET::benchLayers
+  };
+#else
+  const Target Targets::native{
+    targetName,evaluate,evaluate,updateAccumulators,clearCache,loadEval,loadMapped,exportMapped,benchLayers
+  };
+#endif
 }
@@ -2,7 +2,7 @@
 #include "nnue_feature_transformer.h"
 #include <memory>
 
-namespace Nebula::Eval::Nnue{
+namespace NNUE_NAMESPACE{
   constexpr std::uint32_t hashValue=
     FeatureTransformer::getHashValue()^Network::getHashValue();
 
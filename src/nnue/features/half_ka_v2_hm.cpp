@@ -40,6 +40,42 @@ namespace Nebula::Eval::Nnue::Features{
     }
   }
 
+  void HalfKAv2Hm::appendChangedIndices(
+    const Square ksq,
+    const Position& from,
+    const Position& to,
+    const Color perspective,
+    IndexList& removed,
+    IndexList& added
+  ){
+    uint64_t byColorBB[COLOR_NB], byTypeBB[PIECE_TYPE_NB]={};
+    for (const Color c : {WHITE,BLACK})
+      byColorBB[c]=from.pieces(c);
+    for (PieceType pt=PAWN; pt<=KING; ++pt)
+      byTypeBB[pt]=from.pieces(pt);
+    appendChangedIndices(ksq,byColorBB,byTypeBB,to,perspective,removed,added);
+  }
+
+  void HalfKAv2Hm::appendChangedIndices(
+    const Square ksq,
+    const uint64_t* byColorBB,
+    const uint64_t* byTypeBB,
+    const Position& to,
+    const Color perspective,
+    IndexList& removed,
+    IndexList& added
+  ){
+    for (const Color c : {WHITE,BLACK})
+      for (PieceType pt=PAWN; pt<=KING; ++pt){
+        const Piece pc=makePiece(c,pt);
+        const uint64_t before=byColorBB[c]&byTypeBB[pt], after=to.pieces(c,pt);
+        for (uint64_t bb=before&~after; bb;)
+          removed.pushBack(makeIndex(perspective,popLsb(bb),pc,ksq));
+        for (uint64_t bb=after&~before; bb;)
+          added.pushBack(makeIndex(perspective,popLsb(bb),pc,ksq));
+      }
+  }
+
   int HalfKAv2Hm::updateCost(const StateInfo* st){ return st->dirtyPiece.dirty_num; }
   int HalfKAv2Hm::refreshCost(const Position& pos){ return pos.count<ALL_PIECES>(); }
 
@@ -64,6 +64,23 @@ namespace Nebula::Eval::Nnue::Features{
       IndexList& removed,
       IndexList& added
     );
+    static void appendChangedIndices(
+      Square ksq,
+      const Position& from,
+      const Position& to,
+      Color perspective,
+      IndexList& removed,
+      IndexList& added
+    );
+    static void appendChangedIndices(
+      Square ksq,
+      const uint64_t* byColorBB,
+      const uint64_t* byTypeBB,
+      const Position& to,
+      Color perspective,
+      IndexList& removed,
+      IndexList& added
+    );
     static int updateCost(const StateInfo* st);
     static int refreshCost(const Position& pos);
     static bool requiresRefresh(const StateInfo* st, Color perspective);
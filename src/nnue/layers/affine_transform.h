@@ -4,7 +4,7 @@
 #include "../../pragma.h"
 #include "simd.h"
 
-namespace Nebula::Eval::Nnue::Layers{
+namespace NNUE_NAMESPACE::Layers{
 #ifndef USE_SSSE3
   template <IndexType InputDimensions, IndexType PaddedInputDimensions, IndexType OutputDimensions>
   static void affineTransformNonSsse3(std::int32_t* output, const std::int8_t* weights, const std::int32_t* biases,
@@ -83,6 +83,40 @@ namespace Nebula::Eval::Nnue::Layers{
     _mm_empty();
 # endif
   }
+#endif
+#ifdef USE_SSSE3
+  // Registers of the column-wise small layer, which takes the widest one
+  // whose int32 lanes divide its outputs.
+  template <int Bits>
+  struct ColumnSimd;
+#ifdef USE_AVX512
+  template <>
+  struct ColumnSimd<512>{
+    using vec_t = __m512i;
+    static vec_t set32(const std::int32_t v){ return _mm512_set1_epi32(v); }
+    static void addDpbusd32x2(vec_t& acc, const vec_t a0, const vec_t b0, const vec_t a1, const vec_t b1){
+      Simd::m512_add_dpbusd_epi32x2(acc,a0,b0,a1,b1);
+    }
+  };
+#endif
+#ifdef USE_AVX2
+  template <>
+  struct ColumnSimd<256>{
+    using vec_t = __m256i;
+    static vec_t set32(const std::int32_t v){ return _mm256_set1_epi32(v); }
+    static void addDpbusd32x2(vec_t& acc, const vec_t a0, const vec_t b0, const vec_t a1, const vec_t b1){
+      Simd::m256_add_dpbusd_epi32x2(acc,a0,b0,a1,b1);
+    }
+  };
+#endif
+  template <>
+  struct ColumnSimd<128>{
+    using vec_t = __m128i;
+    static vec_t set32(const std::int32_t v){ return _mm_set1_epi32(v); }
+    static void addDpbusd32x2(vec_t& acc, const vec_t a0, const vec_t b0, const vec_t a1, const vec_t b1){
+      Simd::m128_add_dpbusd_epi32x2(acc,a0,b0,a1,b1);
+    }
+  };
 #endif
   template <IndexType InDims, IndexType OutDims, typename Enabled = void>
   class AffineTransform;
@@ -157,6 +191,14 @@ namespace Nebula::Eval::Nnue::Layers{
       return !stream.fail();
     }
 
+    bool writeParameters(std::ostream& stream) const{
+      for (IndexType i=0; i<OutputDimensions; ++i)
+        writeLittleEndian<BiasType>(stream,biases[i]);
+      for (IndexType i=0; i<OutputDimensions*PaddedInputDimensions; ++i)
+        writeLittleEndian<WeightType>(stream,weights[getWeightIndex(i)]);
+      return !stream.fail();
+    }
+
     const OutputType* propagate(
       const InputType* input, OutputType* output) const{
 #ifdef USE_AVX512
@@ -238,6 +280,11 @@ namespace Nebula::Eval::Nnue::Layers{
 #endif
       return output;
     }
+
+    void propagate(const InputType* input, OutputType* output, const IndexType count) const{
+      for (IndexType b=0; b<count; ++b)
+        propagate(input+b*PaddedInputDimensions,output+b*PaddedOutputDimensions);
+    }
   private:
     using BiasType = OutputType;
     using WeightType = std::int8_t;
@@ -259,7 +306,13 @@ namespace Nebula::Eval::Nnue::Layers{
       ceilToMultiple<IndexType>(OutputDimensions,maxSimdWidth);
     using OutputBuffer = OutputType[PaddedOutputDimensions];
 #ifdef USE_SSSE3
-    static constexpr IndexType OutputSimdWidth=SimdWidth/4;
+#ifdef USE_AVX512
+    static constexpr int ColumnBits=OutputDimensions%16==0?512:256;
+#else
+    static constexpr int ColumnBits=SimdWidth*8;
+#endif
+    using Columns = ColumnSimd<ColumnBits>;
+    static constexpr IndexType OutputSimdWidth=ColumnBits/32;
     static constexpr IndexType InputSimdWidth=SimdWidth;
 #endif
     static constexpr std::uint32_t getHashValue(const std::uint32_t prevHash){
@@ -306,44 +359,18 @@ namespace Nebula::Eval::Nnue::Layers{
 #ifdef USE_AVX2
       using vec_t = __m256i;
 #define vec_setzero _mm256_setzero_si256
-#define vec_set_32 _mm256_set1_epi32
 #define vec_add_dpbusd_32 Simd::m256_add_dpbusd_epi32
-#define vec_add_dpbusd_32x2 Simd::m256_add_dpbusd_epi32x2
-#define vec_add_dpbusd_32x4 Simd::m256_add_dpbusd_epi32x4
 #define vec_hadd Simd::m256_hadd
-#define vec_haddx4 Simd::m256_haddx4
 #elif defined (USE_SSSE3)
       using vec_t = __m128i;
 #define vec_setzero _mm_setzero_si128
-#define vec_set_32 _mm_set1_epi32
 #define vec_add_dpbusd_32 Simd::m128_add_dpbusd_epi32
-#define vec_add_dpbusd_32x2 Simd::m128_add_dpbusd_epi32x2
-#define vec_add_dpbusd_32x4 Simd::m128_add_dpbusd_epi32x4
 #define vec_hadd Simd::m128_hadd
-#define vec_haddx4 Simd::m128_haddx4
 #endif
 #ifdef USE_SSSE3
       const auto inputVector=reinterpret_cast<const vec_t*>(input);
-      if constexpr (OutputDimensions%OutputSimdWidth==0){
-        constexpr IndexType NumChunks=ceilToMultiple<IndexType>(InputDimensions,8)/4;
-        constexpr IndexType NumRegs=OutputDimensions/OutputSimdWidth;
-        const auto input32=reinterpret_cast<const std::int32_t*>(input);
-        const vec_t* biasvec=reinterpret_cast<const vec_t*>(biases);
-        vec_t acc[NumRegs];
-        for (IndexType k=0; k<NumRegs; ++k)
-          acc[k]=biasvec[k];
-        for (IndexType i=0; i<NumChunks; i+=2){
-          const vec_t in0=vec_set_32(input32[i+0]);
-          const vec_t in1=vec_set_32(input32[i+1]);
-          const auto col0=reinterpret_cast<const vec_t*>(&weights[(i+0)*OutputDimensions*4]);
-          const auto col1=reinterpret_cast<const vec_t*>(&weights[(i+1)*OutputDimensions*4]);
-          for (IndexType k=0; k<NumRegs; ++k)
-            vec_add_dpbusd_32x2(acc[k],in0,col0[k],in1,col1[k]);
-        }
-        vec_t* outptr=reinterpret_cast<vec_t*>(output);
-        for (IndexType k=0; k<NumRegs; ++k)
-          outptr[k]=acc[k];
-      }
+      if constexpr (OutputDimensions%OutputSimdWidth==0)
+        propagateColumns<1>(input,output);
       else if constexpr (OutputDimensions==1){
         constexpr IndexType NumChunks=PaddedInputDimensions/SimdWidth;
         vec_t sum0=vec_setzero();
@@ -355,12 +382,8 @@ namespace Nebula::Eval::Nnue::Layers{
         output[0]=vec_hadd(sum0,biases[0]);
       }
 # undef vec_setzero
-# undef vec_set_32
 # undef vec_add_dpbusd_32
-# undef vec_add_dpbusd_32x2
-# undef vec_add_dpbusd_32x4
 # undef vec_hadd
-# undef vec_haddx4
 #else
       affineTransformNonSsse3<
         InputDimensions,
@@ -369,7 +392,55 @@ namespace Nebula::Eval::Nnue::Layers{
 #endif
       return output;
     }
+
+    // Applies the layer to count inputs stored PaddedInputDimensions apart.
+    // Each weight column is loaded once for BatchWidth inputs, the sums are
+    // accumulated in the same order as the single input version.
+    void propagate(const InputType* input, OutputType* output, const IndexType count) const{
+      IndexType b=0;
+#ifdef USE_SSSE3
+      if constexpr (OutputDimensions%OutputSimdWidth==0)
+        for (; b+BatchWidth<=count; b+=BatchWidth)
+          propagateColumns<BatchWidth>(input+b*PaddedInputDimensions,output+b*PaddedOutputDimensions);
+#endif
+      for (; b<count; ++b)
+        propagate(input+b*PaddedInputDimensions,output+b*PaddedOutputDimensions);
+    }
   private:
+#ifdef USE_SSSE3
+    static constexpr IndexType BatchWidth=4;
+
+    // Four input bytes at a time are broadcast against a column of the
+    // scrambled weights, which covers every output. Batch inputs share the
+    // column loads and are summed in the same order as a single one.
+    template <IndexType Batch>
+    void propagateColumns(const InputType* input, OutputType* output) const{
+      using vec_t = typename Columns::vec_t;
+      constexpr IndexType NumChunks=ceilToMultiple<IndexType>(InputDimensions,8)/4;
+      constexpr IndexType NumRegs=OutputDimensions/OutputSimdWidth;
+      const vec_t* biasvec=reinterpret_cast<const vec_t*>(biases);
+      vec_t acc[Batch][NumRegs];
+      for (IndexType b=0; b<Batch; ++b)
+        for (IndexType k=0; k<NumRegs; ++k)
+          acc[b][k]=biasvec[k];
+      for (IndexType i=0; i<NumChunks; i+=2){
+        const auto col0=reinterpret_cast<const vec_t*>(&weights[(i+0)*OutputDimensions*4]);
+        const auto col1=reinterpret_cast<const vec_t*>(&weights[(i+1)*OutputDimensions*4]);
+        for (IndexType b=0; b<Batch; ++b){
+          const auto input32=reinterpret_cast<const std::int32_t*>(input+b*PaddedInputDimensions);
+          const vec_t in0=Columns::set32(input32[i+0]);
+          const vec_t in1=Columns::set32(input32[i+1]);
+          for (IndexType k=0; k<NumRegs; ++k)
+            Columns::addDpbusd32x2(acc[b][k],in0,col0[k],in1,col1[k]);
+        }
+      }
+      for (IndexType b=0; b<Batch; ++b){
+        vec_t* outptr=reinterpret_cast<vec_t*>(output+b*PaddedOutputDimensions);
+        for (IndexType k=0; k<NumRegs; ++k)
+          outptr[k]=acc[b][k];
+      }
+    }
+#endif
     using BiasType = OutputType;
     using WeightType = std::int8_t;
     alignas(cacheLineSize) BiasType biases[OutputDimensions]={};
@@ -0,0 +1,187 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include "../nnue_common.h"
+#include "affine_transform.h"
+#include "simd.h"
+
+namespace NNUE_NAMESPACE::Layers{
+#ifdef USE_SSSE3
+  // Positions of the set bits of every byte value, used to turn a movemask
+  // of non-zero input chunks into chunk indices without a branch per bit.
+  alignas(cacheLineSize) inline constexpr std::array<std::array<std::uint16_t, 8>, 256> lookupIndices=[]{
+    std::array<std::array<std::uint16_t, 8>, 256> v{};
+    for (unsigned i=0; i<256; ++i){
+      unsigned j=i, k=0;
+      while (j){
+        v[i][k++]=static_cast<std::uint16_t>(std::countr_zero(j));
+        j&=j-1;
+      }
+    }
+    return v;
+  }();
+
+  // Writes the indices of the non-zero 32-bit chunks of input to out. The
+  // inputs are clipped bytes, so a chunk is never negative as an int32.
+  template <IndexType InputDimensions>
+  void findNnz(const std::int32_t* input, std::uint16_t* out, IndexType& countOut){
+#ifdef USE_AVX512
+    using vec_t = __m512i;
+#define vec_nnz(a) _mm512_cmpgt_epi32_mask(a,_mm512_setzero_si512())
+#elif defined(USE_AVX2)
+    using vec_t = __m256i;
+#define vec_nnz(a) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a,_mm256_setzero_si256())))
+#else
+    using vec_t = __m128i;
+#define vec_nnz(a) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a,_mm_setzero_si128())))
+#endif
+    constexpr IndexType InputSimdWidth=sizeof(vec_t)/sizeof(std::int32_t);
+    constexpr IndexType ChunkSize=std::max<IndexType>(InputSimdWidth,8);
+    constexpr IndexType NumChunks=InputDimensions/ChunkSize;
+    constexpr IndexType InputsPerChunk=ChunkSize/InputSimdWidth;
+    constexpr IndexType OutputsPerChunk=ChunkSize/8;
+    const auto inputVector=reinterpret_cast<const vec_t*>(input);
+    IndexType count=0;
+    __m128i base=_mm_setzero_si128();
+    const __m128i increment=_mm_set1_epi16(8);
+    for (IndexType i=0; i<NumChunks; ++i){
+      unsigned nnz=0;
+      for (IndexType j=0; j<InputsPerChunk; ++j){
+        const vec_t inputChunk=inputVector[i*InputsPerChunk+j];
+        nnz|=static_cast<unsigned>(vec_nnz(inputChunk))<<j*InputSimdWidth;
+      }
+      for (IndexType j=0; j<OutputsPerChunk; ++j){
+        const unsigned lookup=nnz>>j*8&0xFF;
+        const __m128i offsets=_mm_load_si128(reinterpret_cast<const __m128i*>(&lookupIndices[lookup]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out+count),_mm_add_epi16(base,offsets));
+        count+=std::popcount(lookup);
+        base=_mm_add_epi16(base,increment);
+      }
+    }
+    countOut=count;
+  }
+# undef vec_nnz
+#endif
+
+  // First layer of the network. Its inputs come out of the pairwise clipped
+  // product of the feature transformer and are mostly zero, so only the
+  // weight columns of non-zero 4-byte input chunks are accumulated. The
+  // weights are stored column by column for that, see getWeightIndex.
+  template <IndexType InDims, IndexType OutDims>
+  class AffineTransformSparseInput{
+  public:
+    using InputType = std::uint8_t;
+    using OutputType = std::int32_t;
+    static constexpr IndexType InputDimensions=InDims;
+    static constexpr IndexType OutputDimensions=OutDims;
+    static_assert(OutputDimensions%16==0,"Only implemented for OutputDimensions divisible by 16.");
+    static constexpr IndexType PaddedInputDimensions=
+      ceilToMultiple<IndexType>(InputDimensions,maxSimdWidth);
+    static constexpr IndexType PaddedOutputDimensions=
+      ceilToMultiple<IndexType>(OutputDimensions,maxSimdWidth);
+    using OutputBuffer = OutputType[PaddedOutputDimensions];
+#ifdef USE_SSSE3
+    static constexpr IndexType ChunkSize=4;
+#else
+    static constexpr IndexType ChunkSize=1;
+#endif
+
+    static constexpr std::uint32_t getHashValue(const std::uint32_t prevHash){
+      std::uint32_t hashValue=0xCC03DAE4u;
+      hashValue+=OutputDimensions;
+      hashValue^=prevHash>>1;
+      hashValue^=prevHash<<31;
+      return hashValue;
+    }
+
+    static IndexType getWeightIndexScrambled(const IndexType i){
+      return
+        i/ChunkSize%(PaddedInputDimensions/ChunkSize)*OutputDimensions*ChunkSize+
+        i/PaddedInputDimensions*ChunkSize+
+        i%ChunkSize;
+    }
+
+    static IndexType getWeightIndex(const IndexType i){
+#ifdef USE_SSSE3
+      return getWeightIndexScrambled(i);
+#else
+      return i;
+#endif
+    }
+
+    bool readParameters(std::istream& stream){
+      for (IndexType i=0; i<OutputDimensions; ++i)
+        biases[i]=readLittleEndian<BiasType>(stream);
+      for (IndexType i=0; i<OutputDimensions*PaddedInputDimensions; ++i)
+        weights[getWeightIndex(i)]=readLittleEndian<WeightType>(stream);
+      return !stream.fail();
+    }
+
+    bool writeParameters(std::ostream& stream) const{
+      for (IndexType i=0; i<OutputDimensions; ++i)
+        writeLittleEndian<BiasType>(stream,biases[i]);
+      for (IndexType i=0; i<OutputDimensions*PaddedInputDimensions; ++i)
+        writeLittleEndian<WeightType>(stream,weights[getWeightIndex(i)]);
+      return !stream.fail();
+    }
+
+    const OutputType* propagate(
+      const InputType* input, OutputType* output) const{
+#ifdef USE_SSSE3
+#ifdef USE_AVX512
+      using vec_t = __m512i;
+#define vec_set_32 _mm512_set1_epi32
+#define vec_add_dpbusd_32 Simd::m512_add_dpbusd_epi32
+#elif defined(USE_AVX2)
+      using vec_t = __m256i;
+#define vec_set_32 _mm256_set1_epi32
+#define vec_add_dpbusd_32 Simd::m256_add_dpbusd_epi32
+#else
+      using vec_t = __m128i;
+#define vec_set_32 _mm_set1_epi32
+#define vec_add_dpbusd_32 Simd::m128_add_dpbusd_epi32
+#endif
+      constexpr IndexType OutputSimdWidth=sizeof(vec_t)/sizeof(OutputType);
+      constexpr IndexType NumChunks=ceilToMultiple<IndexType>(InputDimensions,8)/ChunkSize;
+      constexpr IndexType NumRegs=OutputDimensions/OutputSimdWidth;
+      std::uint16_t nnz[NumChunks];
+      IndexType count;
+      const auto input32=reinterpret_cast<const std::int32_t*>(input);
+      findNnz<NumChunks>(input32,nnz,count);
+      const vec_t* biasvec=reinterpret_cast<const vec_t*>(biases);
+      vec_t acc[NumRegs];
+      for (IndexType k=0; k<NumRegs; ++k)
+        acc[k]=biasvec[k];
+      for (IndexType j=0; j<count; ++j){
+        const auto i=nnz[j];
+        const vec_t in=vec_set_32(input32[i]);
+        const auto col=reinterpret_cast<const vec_t*>(&weights[i*OutputDimensions*ChunkSize]);
+        for (IndexType k=0; k<NumRegs; ++k)
+          vec_add_dpbusd_32(acc[k],in,col[k]);
+      }
+      vec_t* outptr=reinterpret_cast<vec_t*>(output);
+      for (IndexType k=0; k<NumRegs; ++k)
+        outptr[k]=acc[k];
+# undef vec_set_32
+# undef vec_add_dpbusd_32
+#else
+      affineTransformNonSsse3<
+        InputDimensions,
+        PaddedInputDimensions,
+        OutputDimensions>(output,weights,biases,input);
+#endif
+      return output;
+    }
+
+    void propagate(const InputType* input, OutputType* output, const IndexType count) const{
+      for (IndexType b=0; b<count; ++b)
+        propagate(input+b*PaddedInputDimensions,output+b*PaddedOutputDimensions);
+    }
+  private:
+    using BiasType = OutputType;
+    using WeightType = std::int8_t;
+    alignas(cacheLineSize) BiasType biases[OutputDimensions]={};
+    alignas(cacheLineSize) WeightType weights[OutputDimensions*PaddedInputDimensions]={};
+  };
+}
@@ -1,7 +1,7 @@
 #pragma once
 #include "../nnue_common.h"
 
-namespace Nebula::Eval::Nnue::Layers{
+namespace NNUE_NAMESPACE::Layers{
   template <IndexType InDims>
   class ClippedReLu{
   public:
@@ -22,20 +22,30 @@
 #endif
 namespace Nebula::Simd{
 #ifdef USE_AVX512
-  [[maybe_unused]] static int m512_hadd(__m512i sum, int bias){ return _mm512_reduce_add_epi32(sum)+bias; }
+  // GCC 12 merges the unpack, extract and permute intrinsics into an
+  // uninitialized vector, which -Wmaybe-uninitialized reports at link time.
+  // The zero-masked forms with a full mask are the same instructions.
+  [[maybe_unused]] static int m512_hadd(__m512i sum, int bias){
+    const __m256i sum256=_mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF,sum,0),
+      _mm512_maskz_extracti64x4_epi64(0xFF,sum,1));
+    __m128i sum128=_mm_add_epi32(_mm256_castsi256_si128(sum256),_mm256_extracti128_si256(sum256,1));
+    sum128=_mm_add_epi32(sum128,_mm_shuffle_epi32(sum128,_MM_PERM_BADC));
+    sum128=_mm_add_epi32(sum128,_mm_shuffle_epi32(sum128,_MM_PERM_CDAB));
+    return _mm_cvtsi128_si32(sum128)+bias;
+  }
   [[maybe_unused]] static __m512i m512_hadd128x16_interleave(
     __m512i sum0, __m512i sum1, __m512i sum2, __m512i sum3){
-    __m512i sum01a=_mm512_unpacklo_epi32(sum0,sum1);
-    __m512i sum01b=_mm512_unpackhi_epi32(sum0,sum1);
+    __m512i sum01a=_mm512_maskz_unpacklo_epi32(0xFFFF,sum0,sum1);
+    __m512i sum01b=_mm512_maskz_unpackhi_epi32(0xFFFF,sum0,sum1);
 
-    __m512i sum23a=_mm512_unpacklo_epi32(sum2,sum3);
-    __m512i sum23b=_mm512_unpackhi_epi32(sum2,sum3);
+    __m512i sum23a=_mm512_maskz_unpacklo_epi32(0xFFFF,sum2,sum3);
+    __m512i sum23b=_mm512_maskz_unpackhi_epi32(0xFFFF,sum2,sum3);
 
     __m512i sum01=_mm512_add_epi32(sum01a,sum01b);
     __m512i sum23=_mm512_add_epi32(sum23a,sum23b);
 
-    __m512i sum0123a=_mm512_unpacklo_epi64(sum01,sum23);
-    __m512i sum0123b=_mm512_unpackhi_epi64(sum01,sum23);
+    __m512i sum0123a=_mm512_maskz_unpacklo_epi64(0xFF,sum01,sum23);
+    __m512i sum0123b=_mm512_maskz_unpackhi_epi64(0xFF,sum01,sum23);
 
     return _mm512_add_epi32(sum0123a,sum0123b);
   }
@@ -44,8 +54,8 @@ namespace Nebula::Simd{
     __m128i bias){
     __m512i sum=m512_hadd128x16_interleave(sum0,sum1,sum2,sum3);
 
-    __m256i sum256lo=_mm512_castsi512_si256(sum);
-    __m256i sum256hi=_mm512_extracti64x4_epi64(sum,1);
+    __m256i sum256lo=_mm512_maskz_extracti64x4_epi64(0xFF,sum,0);
+    __m256i sum256hi=_mm512_maskz_extracti64x4_epi64(0xFF,sum,1);
 
     sum256lo=_mm256_add_epi32(sum256lo,sum256hi);
 
@@ -156,6 +166,8 @@ namespace Nebula::Simd{
         : [acc]"+v"(acc)
     :  [a]"v"(a), [b]"vm"(b)
       );
+#   elif defined (USE_AVXVNNI)
+  acc= _mm256_dpbusd_avx_epi32(acc, a, b);
 #   else
   acc= _mm256_dpbusd_epi32(acc, a, b);
 #   endif
@@ -189,6 +201,9 @@ namespace Nebula::Simd{
         : [acc]"+v"(acc)
     :  [a0]"v"(a0), [b0]"vm"(b0), [a1]"v"(a1), [b1]"vm"(b1)
       );
+#   elif defined (USE_AVXVNNI)
+  acc= _mm256_dpbusd_avx_epi32(acc, a0, b0);
+  acc= _mm256_dpbusd_avx_epi32(acc, a1, b1);
 #   else
   acc= _mm256_dpbusd_epi32(acc, a0, b0);
   acc= _mm256_dpbusd_epi32(acc, a1, b1);
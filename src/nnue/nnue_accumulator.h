@@ -1,10 +1,45 @@
 #pragma once
-#include "nnue_architecture.h"
+#include "nnue_common.h"
+#include "../types.h"
 
 namespace Nebula::Eval::Nnue{
   struct alignas(cacheLineSize) Accumulator{
     std::int16_t accumulation[2][transformedFeatureDimensions];
     std::int32_t psqtAccumulation[2][psqtBuckets];
+    std::uint64_t key;
     bool computed[2];
   };
+
+  // Per thread accumulators of the line being searched, indexed by the moves
+  // made since the position was set. An entry is only used for the position
+  // whose key it holds, so positions sharing a thread just recompute. Left
+  // uninitialized so that clear(), run on the pool thread, first touches it.
+  struct AccumulatorStack{
+    static constexpr int size=256;
+    static_assert(size>maxPly&&(size&(size-1))==0);
+    Accumulator& operator[](const int idx){ return entries[idx&(size-1)]; }
+    void clear(){
+      for (Accumulator& a : entries){
+        a.key=0;
+        a.computed[WHITE]=a.computed[BLACK]=false;
+      }
+    }
+    Accumulator entries[size];
+  };
+
+  // Per thread copies of the accumulator for every king square and
+  // perspective, with the pieces they were last computed for. A refresh
+  // starts from the entry and only applies what changed on the board.
+  struct AccumulatorCache{
+    struct alignas(cacheLineSize) Entry{
+      std::int16_t accumulation[transformedFeatureDimensions];
+      std::int32_t psqtAccumulation[psqtBuckets];
+      std::uint64_t byColorBB[COLOR_NB];
+      std::uint64_t byTypeBB[PIECE_TYPE_NB];
+    };
+    Entry entries[SQUARE_NB][COLOR_NB];
+#ifdef USE_SEARCH_STATS
+    std::uint64_t refreshes, updates, skipped;
+#endif
+  };
 }
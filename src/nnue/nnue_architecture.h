@@ -2,19 +2,24 @@
 #include "nnue_common.h"
 #include "features/half_ka_v2_hm.h"
 #include "layers/affine_transform.h"
+#include "layers/affine_transform_sparse_input.h"
 #include "layers/clipped_relu.h"
 #include "layers/sqr_clipped_relu.h"
 
-namespace Nebula::Eval::Nnue{
+namespace NNUE_NAMESPACE{
   using FeatureSet = Features::HalfKAv2Hm;
-  constexpr IndexType transformedFeatureDimensions=1024;
-  constexpr IndexType psqtBuckets=8;
-  constexpr IndexType layerStacks=8;
+  constexpr IndexType maxBatchSize=64;
 
   struct Network{
     static constexpr int FC_0_OUTPUTS=15;
     static constexpr int FC_1_OUTPUTS=32;
+    // The sparse layer only pays off with a net whose transformed features
+    // are mostly zero. With the default net the dense one is faster.
+#ifdef USE_SPARSE_FC0
+    Layers::AffineTransformSparseInput<transformedFeatureDimensions, FC_0_OUTPUTS+1> fc_0{};
+#else
     Layers::AffineTransform<transformedFeatureDimensions, FC_0_OUTPUTS+1> fc_0{};
+#endif
     Layers::SqrClippedReLu<FC_0_OUTPUTS+1> ac_sqr_0{};
     Layers::ClippedReLu<FC_0_OUTPUTS+1> ac_0{};
     Layers::AffineTransform<FC_0_OUTPUTS*2, FC_1_OUTPUTS> fc_1{};
@@ -50,7 +55,7 @@ namespace Nebula::Eval::Nnue{
       return true;
     }
 
-    std::int32_t propagate(const TransformedFeatureType* transformedFeatures){
+    std::int32_t propagate(const TransformedFeatureType* transformedFeatures) const{
       struct alignas(cacheLineSize) Buffer{
         alignas(cacheLineSize) decltype(fc_0)::OutputBuffer fc_0_out;
         alignas(cacheLineSize) decltype(ac_sqr_0)::OutputType ac_sqr_0_out[ceilToMultiple<IndexType>(
@@ -76,5 +81,38 @@ namespace Nebula::Eval::Nnue{
       const std::int32_t outputValue=buffer.fc_2_out[0]+fwdOut;
       return outputValue;
     }
+
+    // Batched form of propagate. Every layer runs over all inputs before the
+    // next one starts, so fc_1 works as a matrix-matrix product.
+    void propagate(const TransformedFeatureType* transformedFeatures, const IndexType count, std::int32_t* output) const{
+      struct alignas(cacheLineSize) Buffer{
+        alignas(cacheLineSize) decltype(fc_0)::OutputBuffer fc_0_out[maxBatchSize];
+        alignas(cacheLineSize) decltype(ac_sqr_0)::OutputType ac_sqr_0_out[maxBatchSize][ceilToMultiple<IndexType>(
+          FC_0_OUTPUTS*2,32)];
+        alignas(cacheLineSize) decltype(ac_0)::OutputBuffer ac_0_out[maxBatchSize];
+        alignas(cacheLineSize) decltype(fc_1)::OutputBuffer fc_1_out[maxBatchSize];
+        alignas(cacheLineSize) decltype(ac_1)::OutputBuffer ac_1_out[maxBatchSize];
+        alignas(cacheLineSize) decltype(fc_2)::OutputBuffer fc_2_out[maxBatchSize];
+        Buffer(){ std::memset(this,0,sizeof(*this)); }
+      };
+
+      alignas(cacheLineSize) thread_local Buffer buffer;
+
+      fc_0.propagate(transformedFeatures,buffer.fc_0_out[0],count);
+      for (IndexType i=0; i<count; ++i){
+        ac_sqr_0.propagate(buffer.fc_0_out[i],buffer.ac_sqr_0_out[i]);
+        ac_0.propagate(buffer.fc_0_out[i],buffer.ac_0_out[i]);
+        std::memcpy(buffer.ac_sqr_0_out[i]+FC_0_OUTPUTS,buffer.ac_0_out[i],
+          FC_0_OUTPUTS*sizeof(decltype(ac_0)::OutputType));
+      }
+      fc_1.propagate(buffer.ac_sqr_0_out[0],buffer.fc_1_out[0],count);
+      for (IndexType i=0; i<count; ++i)
+        ac_1.propagate(buffer.fc_1_out[i],buffer.ac_1_out[i]);
+      fc_2.propagate(buffer.ac_1_out[0],buffer.fc_2_out[0],count);
+      for (IndexType i=0; i<count; ++i){
+        const std::int32_t fwdOut=buffer.fc_0_out[i][FC_0_OUTPUTS]*(600*outputScale)/(127*(1<<weightScaleBits));
+        output[i]=buffer.fc_2_out[i][0]+fwdOut;
+      }
+    }
   };
 }
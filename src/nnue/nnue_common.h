@@ -14,6 +14,15 @@
 #elif defined(USE_NEON)
 #include <arm_neon.h>
 #endif
+// Fat builds compile evaluate_nnue.cpp once per instruction set with
+// NNUE_TARGET set, see Makefile. The layers of each copy go into their own
+// namespace so the linker never merges instantiations built for different
+// instruction sets.
+#ifdef NNUE_TARGET
+#define NNUE_NAMESPACE Nebula::Eval::Nnue::inline NNUE_TARGET
+#else
+#define NNUE_NAMESPACE Nebula::Eval::Nnue
+#endif
 namespace Nebula::Eval::Nnue{
   constexpr std::uint32_t nnueVersion=0x7AF32F20u;
   constexpr int outputScale=16;
@@ -31,6 +40,9 @@ namespace Nebula::Eval::Nnue{
   constexpr std::size_t maxSimdWidth=32;
   using TransformedFeatureType = std::uint8_t;
   using IndexType = std::uint32_t;
+  constexpr IndexType transformedFeatureDimensions=1024;
+  constexpr IndexType psqtBuckets=8;
+  constexpr IndexType layerStacks=8;
 
   template <typename IntType>
   constexpr IntType ceilToMultiple(IntType n, IntType base){ return (n+base-1)/base*base; }
@@ -1,9 +1,10 @@
 #pragma once
 #include "nnue_common.h"
 #include "nnue_architecture.h"
+#include "nnue_accumulator.h"
 #include <cstring>
 
-namespace Nebula::Eval::Nnue{
+namespace NNUE_NAMESPACE{
   using BiasType = std::int16_t;
   using WeightType = std::int16_t;
   using PsqtWeightType = std::int32_t;
@@ -22,7 +23,7 @@ namespace Nebula::Eval::Nnue{
 #define vec_min_16(a,b) _mm512_min_epi16(a,b)
   inline vec_t vec_msb_pack_16(vec_t a, vec_t b){
     vec_t compacted=_mm512_packs_epi16(_mm512_srli_epi16(a,7),_mm512_srli_epi16(b,7));
-    return _mm512_permutexvar_epi64(_mm512_setr_epi64(0,2,4,6,1,3,5,7),compacted);
+    return _mm512_maskz_permutexvar_epi64(0xFF,_mm512_setr_epi64(0,2,4,6,1,3,5,7),compacted);
   }
 #define vec_load_psqt(a) _mm256_load_si256(a)
 #define vec_store_psqt(a,b) _mm256_store_si256(a,b)
@@ -184,12 +185,28 @@ namespace Nebula::Eval::Nnue{
       return !stream.fail();
     }
 
-    std::int32_t transform(const Position& pos, OutputType* output, const int bucket) const{
-      updateAccumulator(pos,WHITE);
-      updateAccumulator(pos,BLACK);
-      const Color perspectives[2]={pos.stm(),~pos.stm()};
-      const auto& accumulation=pos.state()->accumulator.accumulation;
-      const auto& psqtAccumulation=pos.state()->accumulator.psqtAccumulation;
+    void updateAccumulators(const Position& pos, AccumulatorStack& stack, AccumulatorCache& cache) const{
+      PendingUpdate updates[2];
+      int count=0;
+      for (const Color perspective : {WHITE,BLACK})
+        count+=findUpdate(pos,perspective,stack,cache,updates[count]);
+      if (count)
+        applyUpdates(updates,count);
+#ifdef USE_MMX
+      _mm_empty();
+#endif
+    }
+
+    std::int32_t transform(const Position& pos, AccumulatorStack& stack, AccumulatorCache& cache, OutputType* output,
+      const int bucket) const{
+      updateAccumulators(pos,stack,cache);
+      return transform(stack[pos.accumulatorIndex()],pos.stm(),output,bucket);
+    }
+
+    std::int32_t transform(const Accumulator& accumulator, const Color stm, OutputType* output, const int bucket) const{
+      const Color perspectives[2]={stm,~stm};
+      const auto& accumulation=accumulator.accumulation;
+      const auto& psqtAccumulation=accumulator.psqtAccumulation;
       const auto psqt=(
         psqtAccumulation[perspectives[0]][bucket]
         -psqtAccumulation[perspectives[1]][bucket]
@@ -228,42 +245,237 @@ namespace Nebula::Eval::Nnue{
 #endif
       return psqt;
     }
-  private:
-    void updateAccumulator(const Position& pos, const Color perspective) const{
+
+    // Computes the accumulators of up to maxBatchSize positions. A position
+    // whose king stands where it did in the previous one starts from that
+    // accumulator when fewer features differ than are active, so positions
+    // sorted by king squares mostly load only the changed weight columns.
+    void refreshBatch(const Position* const* pos, const std::size_t count, Accumulator* accumulators) const{
+      FeatureSet::IndexList removed[maxBatchSize][COLOR_NB], added[maxBatchSize][COLOR_NB];
+      // Never set for the first position. The i>0 tests on it below let the
+      // compiler see that accumulators[i-1] stays in bounds.
+      bool fromPrevious[maxBatchSize][COLOR_NB]={};
+      for (std::size_t i=0; i<count; ++i)
+        for (const Color perspective : {WHITE,BLACK}){
+          accumulators[i].computed[perspective]=true;
+          const Square ksq=pos[i]->square<KING>(perspective);
+          if (i>0&&pos[i-1]->square<KING>(perspective)==ksq){
+            FeatureSet::appendChangedIndices(ksq,*pos[i-1],*pos[i],perspective,
+              removed[i][perspective],added[i][perspective]);
+            if (static_cast<int>(removed[i][perspective].size()+added[i][perspective].size())<
+              pos[i]->count<ALL_PIECES>()){
+              fromPrevious[i][perspective]=true;
+              continue;
+            }
+            removed[i][perspective]={};
+            added[i][perspective]={};
+          }
+          FeatureSet::appendActiveIndices(*pos[i],perspective,added[i][perspective]);
+        }
 #ifdef VECTOR
       vec_t acc[NumRegs];
       psqt_vec_t psqt[NumPsqtRegs];
+      for (IndexType j=0; j<HalfDimensions/TileHeight; ++j)
+        for (std::size_t i=0; i<count; ++i)
+          for (const Color perspective : {WHITE,BLACK}){
+            auto startTile=reinterpret_cast<const vec_t*>(i>0&&fromPrevious[i][perspective]
+                                                          ?&accumulators[i-1].accumulation[perspective][j*TileHeight]
+                                                          :&biases[j*TileHeight]);
+            for (IndexType k=0; k<NumRegs; ++k)
+              acc[k]=vec_load(&startTile[k]);
+            for (const auto index : removed[i][perspective]){
+              const IndexType offset=HalfDimensions*index+j*TileHeight;
+              auto column=reinterpret_cast<const vec_t*>(&weights[offset]);
+              for (IndexType k=0; k<NumRegs; ++k)
+                acc[k]=vec_sub_16(acc[k],column[k]);
+            }
+            for (const auto index : added[i][perspective]){
+              const IndexType offset=HalfDimensions*index+j*TileHeight;
+              auto column=reinterpret_cast<const vec_t*>(&weights[offset]);
+              for (IndexType k=0; k<NumRegs; ++k)
+                acc[k]=vec_add_16(acc[k],column[k]);
+            }
+            auto accTile=reinterpret_cast<vec_t*>(&accumulators[i].accumulation[perspective][j*TileHeight]);
+            for (IndexType k=0; k<NumRegs; ++k)
+              vec_store(&accTile[k],acc[k]);
+          }
+      for (IndexType j=0; j<psqtBuckets/PsqtTileHeight; ++j)
+        for (std::size_t i=0; i<count; ++i)
+          for (const Color perspective : {WHITE,BLACK}){
+            if (i>0&&fromPrevious[i][perspective]){
+              auto startTilePsqt=reinterpret_cast<const psqt_vec_t*>(
+                &accumulators[i-1].psqtAccumulation[perspective][j*PsqtTileHeight]);
+              for (std::size_t k=0; k<NumPsqtRegs; ++k)
+                psqt[k]=vec_load_psqt(&startTilePsqt[k]);
+            }
+            else
+              for (std::size_t k=0; k<NumPsqtRegs; ++k)
+                psqt[k]=vec_zero_psqt();
+            for (const auto index : removed[i][perspective]){
+              const IndexType offset=psqtBuckets*index+j*PsqtTileHeight;
+              auto columnPsqt=reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+              for (std::size_t k=0; k<NumPsqtRegs; ++k)
+                psqt[k]=vec_sub_psqt_32(psqt[k],columnPsqt[k]);
+            }
+            for (const auto index : added[i][perspective]){
+              const IndexType offset=psqtBuckets*index+j*PsqtTileHeight;
+              auto columnPsqt=reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+              for (std::size_t k=0; k<NumPsqtRegs; ++k)
+                psqt[k]=vec_add_psqt_32(psqt[k],columnPsqt[k]);
+            }
+            auto accTilePsqt=reinterpret_cast<psqt_vec_t*>(
+              &accumulators[i].psqtAccumulation[perspective][j*PsqtTileHeight]);
+            for (std::size_t k=0; k<NumPsqtRegs; ++k)
+              vec_store_psqt(&accTilePsqt[k],psqt[k]);
+          }
+#else
+      for (std::size_t i=0; i<count; ++i)
+        for (const Color perspective : {WHITE,BLACK}){
+          auto& [accumulation, psqtAccumulation, key, computed]=accumulators[i];
+          if (i>0&&fromPrevious[i][perspective]){
+            std::memcpy(accumulation[perspective],accumulators[i-1].accumulation[perspective],
+              HalfDimensions*sizeof(BiasType));
+            std::memcpy(psqtAccumulation[perspective],accumulators[i-1].psqtAccumulation[perspective],
+              psqtBuckets*sizeof(PsqtWeightType));
+          }
+          else{
+            std::memcpy(accumulation[perspective],biases,HalfDimensions*sizeof(BiasType));
+            for (std::size_t k=0; k<psqtBuckets; ++k)
+              psqtAccumulation[perspective][k]=0;
+          }
+          for (const auto index : removed[i][perspective]){
+            const IndexType offset=HalfDimensions*index;
+            for (IndexType j=0; j<HalfDimensions; ++j)
+              accumulation[perspective][j]=
+                static_cast<std::int16_t>(accumulation[perspective][j]-
+                  static_cast<std::int16_t>(weights[offset+j]));
+            for (std::size_t k=0; k<psqtBuckets; ++k)
+              psqtAccumulation[perspective][k]-=psqtWeights[static_cast<unsigned long long>(index)*
+                psqtBuckets+k];
+          }
+          for (const auto index : added[i][perspective]){
+            const IndexType offset=HalfDimensions*index;
+            for (IndexType j=0; j<HalfDimensions; ++j)
+              accumulation[perspective][j]=
+                static_cast<std::int16_t>(accumulation[perspective][j]+
+                  static_cast<std::int16_t>(weights[offset+j]));
+            for (std::size_t k=0; k<psqtBuckets; ++k)
+              psqtAccumulation[perspective][k]+=psqtWeights[static_cast<unsigned long long>(index)*
+                psqtBuckets+k];
+          }
+        }
+#endif
+#ifdef USE_MMX
+      _mm_empty();
 #endif
+    }
+    // Entries start as the accumulator of an empty board.
+    void clearCache(AccumulatorCache& cache) const{
+      for (auto& bySquare : cache.entries)
+        for (AccumulatorCache::Entry& entry : bySquare){
+          std::memcpy(entry.accumulation,biases,sizeof(biases));
+          std::memset(entry.psqtAccumulation,0,sizeof(entry.psqtAccumulation));
+          std::memset(entry.byColorBB,0,sizeof(entry.byColorBB));
+          std::memset(entry.byTypeBB,0,sizeof(entry.byTypeBB));
+        }
+    }
+  private:
+    static bool computed(const Accumulator& acc, const StateInfo* st, const Color perspective){
+      return acc.key==st->key&&acc.computed[perspective];
+    }
+
+    static void setComputed(Accumulator& acc, const StateInfo* st, const Color perspective){
+      if (acc.key!=st->key){
+        acc.key=st->key;
+        acc.computed[~perspective]=false;
+      }
+      acc.computed[perspective]=true;
+    }
+
+    // A feature removed by one queued move and added by another, a piece
+    // that moved twice, cancels. The wrapping sums come out the same either
+    // way.
+    static void cancelChanges(FeatureSet::IndexList& removed, FeatureSet::IndexList& added){
+      for (std::size_t i=0; i<removed.size();){
+        std::size_t j=0;
+        while (j<added.size()&&added[j]!=removed[i])
+          ++j;
+        if (j<added.size()){
+          removed.erase(i);
+          added.erase(j);
+        }
+        else
+          ++i;
+      }
+    }
+
+    // The accumulators one perspective still needs, each computed from the
+    // one before it starting at the last computed accumulator.
+    struct PendingUpdate{
+      Color perspective;
+      Accumulator* from;
+      Accumulator* toUpdate[3];
+      FeatureSet::IndexList removed[2], added[2];
+    };
+
+    // Refreshes right away when no computed accumulator is cheap enough to
+    // start from, otherwise fills u for applyUpdates.
+    bool findUpdate(const Position& pos, const Color perspective, AccumulatorStack& stack, AccumulatorCache& cache,
+      PendingUpdate& u) const{
       StateInfo *st=pos.state(), *next=nullptr;
+      int idx=pos.accumulatorIndex(), nextIdx=idx;
       int gain=FeatureSet::refreshCost(pos);
-      while (st->previous&&!st->accumulator.computed[perspective]){
+      while (st->previous&&!computed(stack[idx],st,perspective)){
         if (FeatureSet::requiresRefresh(st,perspective)
           ||(gain-=FeatureSet::updateCost(st)+1)<0)
           break;
         next=st;
+        nextIdx=idx--;
         st=st->previous;
       }
-      if (st->accumulator.computed[perspective]){
-        if (next==nullptr)
-          return;
-        const Square ksq=pos.square<KING>(perspective);
-        FeatureSet::IndexList removed[2], added[2];
+      if (!computed(stack[idx],st,perspective)){
+        refreshAccumulator(pos,perspective,stack,cache);
+        return false;
+      }
+      if (next==nullptr)
+        return false;
+#ifdef USE_SEARCH_STATS
+      ++cache.updates;
+      for (const StateInfo* st2=pos.state(); st2!=next; st2=st2->previous)
+        cache.skipped+=st2!=pos.state();
+#endif
+      const Square ksq=pos.square<KING>(perspective);
+      auto& [p, from, toUpdate, removed, added]=u;
+      FeatureSet::appendChangedIndices(
+        ksq,next->dirtyPiece,perspective,removed[0],added[0]);
+      for (const StateInfo* st2=pos.state(); st2!=next; st2=st2->previous)
         FeatureSet::appendChangedIndices(
-          ksq,next->dirtyPiece,perspective,removed[0],added[0]);
-        for (const StateInfo* st2=pos.state(); st2!=next; st2=st2->previous)
-          FeatureSet::appendChangedIndices(
-            ksq,st2->dirtyPiece,perspective,removed[1],added[1]);
-        next->accumulator.computed[perspective]=true;
-        pos.state()->accumulator.computed[perspective]=true;
-        StateInfo* statesToUpdate[3]=
-          {next,next==pos.state()?nullptr:pos.state(),nullptr};
+          ksq,st2->dirtyPiece,perspective,removed[1],added[1]);
+      cancelChanges(removed[1],added[1]);
+      p=perspective;
+      from=&stack[idx];
+      toUpdate[0]=&stack[nextIdx];
+      toUpdate[1]=next==pos.state()?nullptr:&stack[pos.accumulatorIndex()];
+      toUpdate[2]=nullptr;
+      setComputed(*toUpdate[0],next,perspective);
+      setComputed(stack[pos.accumulatorIndex()],pos.state(),perspective);
+      return true;
+    }
+
+    // Both perspectives run through one tile loop, so the loop and the tile
+    // offsets are shared and the two dependency chains interleave.
+    void applyUpdates(const PendingUpdate* updates, const int count) const{
 #ifdef VECTOR
-        for (IndexType j=0; j<HalfDimensions/TileHeight; ++j){
+      vec_t acc[NumRegs];
+      psqt_vec_t psqt[NumPsqtRegs];
+      for (IndexType j=0; j<HalfDimensions/TileHeight; ++j)
+        for (int n=0; n<count; ++n){
+          const auto& [perspective, from, toUpdate, removed, added]=updates[n];
           auto accTile=reinterpret_cast<vec_t*>(
-            &st->accumulator.accumulation[perspective][j*TileHeight]);
+            &from->accumulation[perspective][j*TileHeight]);
           for (IndexType k=0; k<NumRegs; ++k)
             acc[k]=vec_load(&accTile[k]);
-          for (IndexType i=0; statesToUpdate[i]; ++i){
+          for (IndexType i=0; toUpdate[i]; ++i){
             for (const auto index : removed[i]){
               const IndexType offset=HalfDimensions*index+j*TileHeight;
               auto column=reinterpret_cast<const vec_t*>(&weights[offset]);
@@ -277,17 +489,19 @@ namespace Nebula::Eval::Nnue{
                 acc[k]=vec_add_16(acc[k],column[k]);
             }
             accTile=reinterpret_cast<vec_t*>(
-              &statesToUpdate[i]->accumulator.accumulation[perspective][j*TileHeight]);
+              &toUpdate[i]->accumulation[perspective][j*TileHeight]);
             for (IndexType k=0; k<NumRegs; ++k)
               vec_store(&accTile[k],acc[k]);
           }
         }
-        for (IndexType j=0; j<psqtBuckets/PsqtTileHeight; ++j){
+      for (IndexType j=0; j<psqtBuckets/PsqtTileHeight; ++j)
+        for (int n=0; n<count; ++n){
+          const auto& [perspective, from, toUpdate, removed, added]=updates[n];
           auto accTilePsqt=reinterpret_cast<psqt_vec_t*>(
-            &st->accumulator.psqtAccumulation[perspective][j*PsqtTileHeight]);
+            &from->psqtAccumulation[perspective][j*PsqtTileHeight]);
           for (std::size_t k=0; k<NumPsqtRegs; ++k)
             psqt[k]=vec_load_psqt(&accTilePsqt[k]);
-          for (IndexType i=0; statesToUpdate[i]; ++i){
+          for (IndexType i=0; toUpdate[i]; ++i){
             for (const auto index : removed[i]){
               const IndexType offset=psqtBuckets*index+j*PsqtTileHeight;
               auto columnPsqt=reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
@@ -301,101 +515,142 @@ namespace Nebula::Eval::Nnue{
                 psqt[k]=vec_add_psqt_32(psqt[k],columnPsqt[k]);
             }
             accTilePsqt=reinterpret_cast<psqt_vec_t*>(
-              &statesToUpdate[i]->accumulator.psqtAccumulation[perspective][j*PsqtTileHeight]);
+              &toUpdate[i]->psqtAccumulation[perspective][j*PsqtTileHeight]);
             for (std::size_t k=0; k<NumPsqtRegs; ++k)
               vec_store_psqt(&accTilePsqt[k],psqt[k]);
           }
         }
 #else
-        for (IndexType i=0; statesToUpdate[i]; ++i){
-          std::memcpy(statesToUpdate[i]->accumulator.accumulation[perspective],
-            st->accumulator.accumulation[perspective],
+      for (int n=0; n<count; ++n){
+        const auto& [perspective, from, toUpdate, removed, added]=updates[n];
+        for (IndexType i=0; toUpdate[i]; ++i){
+          const Accumulator& prev=i?*toUpdate[i-1]:*from;
+          std::memcpy(toUpdate[i]->accumulation[perspective],prev.accumulation[perspective],
             HalfDimensions*sizeof(BiasType));
           for (std::size_t k=0; k<psqtBuckets; ++k)
-            statesToUpdate[i]->accumulator.psqtAccumulation[perspective][k]=st->accumulator.psqtAccumulation[
-              perspective][k];
-          st=statesToUpdate[i];
+            toUpdate[i]->psqtAccumulation[perspective][k]=prev.psqtAccumulation[perspective][k];
+          Accumulator& a=*toUpdate[i];
           for (const auto index : removed[i]){
             const IndexType offset=HalfDimensions*index;
             for (IndexType j=0; j<HalfDimensions; ++j)
-              st->accumulator.accumulation[perspective][j]=
-                static_cast<std::int16_t>(st->accumulator.accumulation[perspective][j]-
+              a.accumulation[perspective][j]=
+                static_cast<std::int16_t>(a.accumulation[perspective][j]-
                   static_cast<std::int16_t>(weights[offset+j]));
 
             for (std::size_t k=0; k<psqtBuckets; ++k)
-              st->accumulator.psqtAccumulation[perspective][k]-=psqtWeights[static_cast<unsigned long long>(index)*
+              a.psqtAccumulation[perspective][k]-=psqtWeights[static_cast<unsigned long long>(index)*
                 psqtBuckets+k];
           }
           for (const auto index : added[i]){
             const IndexType offset=HalfDimensions*index;
             for (IndexType j=0; j<HalfDimensions; ++j)
-              st->accumulator.accumulation[perspective][j]=
-                static_cast<std::int16_t>(st->accumulator.accumulation[perspective][j]+
+              a.accumulation[perspective][j]=
+                static_cast<std::int16_t>(a.accumulation[perspective][j]+
                   static_cast<std::int16_t>(weights[offset+j]));
 
             for (std::size_t k=0; k<psqtBuckets; ++k)
-              st->accumulator.psqtAccumulation[perspective][k]+=psqtWeights[static_cast<unsigned long long>(index)*
+              a.psqtAccumulation[perspective][k]+=psqtWeights[static_cast<unsigned long long>(index)*
                 psqtBuckets+k];
           }
         }
-#endif
       }
-      else{
-        auto& [accumulation, psqtAccumulation, computed]=pos.state()->accumulator;
-        computed[perspective]=true;
-        FeatureSet::IndexList active;
-        FeatureSet::appendActiveIndices(pos,perspective,active);
+#endif
+    }
+
+    void refreshAccumulator(const Position& pos, const Color perspective, AccumulatorStack& stack,
+      AccumulatorCache& cache) const{
+#ifdef VECTOR
+      vec_t acc[NumRegs];
+      psqt_vec_t psqt[NumPsqtRegs];
+#endif
+      Accumulator& a=stack[pos.accumulatorIndex()];
+      auto& accumulation=a.accumulation;
+      auto& psqtAccumulation=a.psqtAccumulation;
+      setComputed(a,pos.state(),perspective);
+#ifdef USE_SEARCH_STATS
+      ++cache.refreshes;
+#endif
+      const Square ksq=pos.square<KING>(perspective);
+      AccumulatorCache::Entry& entry=cache.entries[ksq][perspective];
+      FeatureSet::IndexList removed, added;
+      FeatureSet::appendChangedIndices(ksq,entry.byColorBB,entry.byTypeBB,pos,perspective,removed,added);
 #ifdef VECTOR
-        for (IndexType j=0; j<HalfDimensions/TileHeight; ++j){
-          auto biasesTile=reinterpret_cast<const vec_t*>(
-            &biases[j*TileHeight]);
+      for (IndexType j=0; j<HalfDimensions/TileHeight; ++j){
+        auto entryTile=reinterpret_cast<vec_t*>(&entry.accumulation[j*TileHeight]);
+        for (IndexType k=0; k<NumRegs; ++k)
+          acc[k]=vec_load(&entryTile[k]);
+        for (const auto index : removed){
+          const IndexType offset=HalfDimensions*index+j*TileHeight;
+          auto column=reinterpret_cast<const vec_t*>(&weights[offset]);
           for (IndexType k=0; k<NumRegs; ++k)
-            acc[k]=biasesTile[k];
-          for (const auto index : active){
-            const IndexType offset=HalfDimensions*index+j*TileHeight;
-            auto column=reinterpret_cast<const vec_t*>(&weights[offset]);
-            for (unsigned k=0; k<NumRegs; ++k)
-              acc[k]=vec_add_16(acc[k],column[k]);
-          }
-          auto accTile=reinterpret_cast<vec_t*>(
-            &accumulation[perspective][j*TileHeight]);
-          for (unsigned k=0; k<NumRegs; k++)
-            vec_store(&accTile[k],acc[k]);
+            acc[k]=vec_sub_16(acc[k],column[k]);
         }
-        for (IndexType j=0; j<psqtBuckets/PsqtTileHeight; ++j){
+        for (const auto index : added){
+          const IndexType offset=HalfDimensions*index+j*TileHeight;
+          auto column=reinterpret_cast<const vec_t*>(&weights[offset]);
+          for (IndexType k=0; k<NumRegs; ++k)
+            acc[k]=vec_add_16(acc[k],column[k]);
+        }
+        auto accTile=reinterpret_cast<vec_t*>(
+          &accumulation[perspective][j*TileHeight]);
+        for (IndexType k=0; k<NumRegs; k++){
+          vec_store(&entryTile[k],acc[k]);
+          vec_store(&accTile[k],acc[k]);
+        }
+      }
+      for (IndexType j=0; j<psqtBuckets/PsqtTileHeight; ++j){
+        auto entryTilePsqt=reinterpret_cast<psqt_vec_t*>(&entry.psqtAccumulation[j*PsqtTileHeight]);
+        for (std::size_t k=0; k<NumPsqtRegs; ++k)
+          psqt[k]=vec_load_psqt(&entryTilePsqt[k]);
+        for (const auto index : removed){
+          const IndexType offset=psqtBuckets*index+j*PsqtTileHeight;
+          auto columnPsqt=reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
           for (std::size_t k=0; k<NumPsqtRegs; ++k)
-            psqt[k]=vec_zero_psqt();
-          for (const auto index : active){
-            const IndexType offset=psqtBuckets*index+j*PsqtTileHeight;
-            auto columnPsqt=reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
-            for (std::size_t k=0; k<NumPsqtRegs; ++k)
-              psqt[k]=vec_add_psqt_32(psqt[k],columnPsqt[k]);
-          }
-          auto accTilePsqt=reinterpret_cast<psqt_vec_t*>(
-            &psqtAccumulation[perspective][j*PsqtTileHeight]);
+            psqt[k]=vec_sub_psqt_32(psqt[k],columnPsqt[k]);
+        }
+        for (const auto index : added){
+          const IndexType offset=psqtBuckets*index+j*PsqtTileHeight;
+          auto columnPsqt=reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
           for (std::size_t k=0; k<NumPsqtRegs; ++k)
-            vec_store_psqt(&accTilePsqt[k],psqt[k]);
+            psqt[k]=vec_add_psqt_32(psqt[k],columnPsqt[k]);
         }
+        auto accTilePsqt=reinterpret_cast<psqt_vec_t*>(
+          &psqtAccumulation[perspective][j*PsqtTileHeight]);
+        for (std::size_t k=0; k<NumPsqtRegs; ++k){
+          vec_store_psqt(&entryTilePsqt[k],psqt[k]);
+          vec_store_psqt(&accTilePsqt[k],psqt[k]);
+        }
+      }
 #else
-        std::memcpy(accumulation[perspective],biases,
-          HalfDimensions*sizeof(BiasType));
+      for (const auto index : removed){
+        const IndexType offset=HalfDimensions*index;
+        for (IndexType j=0; j<HalfDimensions; ++j)
+          entry.accumulation[j]=
+            static_cast<std::int16_t>(entry.accumulation[j]-
+              static_cast<std::int16_t>(weights[offset+j]));
         for (std::size_t k=0; k<psqtBuckets; ++k)
-          psqtAccumulation[perspective][k]=0;
-        for (const auto index : active){
-          const IndexType offset=HalfDimensions*index;
-          for (IndexType j=0; j<HalfDimensions; ++j)
-            accumulation[perspective][j]=
-              static_cast<std::int16_t>(accumulation[perspective][j]+
-                static_cast<std::int16_t>(weights[offset+j]));
-          for (std::size_t k=0; k<psqtBuckets; ++k)
-            psqtAccumulation[perspective][k]+=psqtWeights[static_cast<unsigned long long>(index)*
-              psqtBuckets+k];
-        }
-#endif
+          entry.psqtAccumulation[k]-=psqtWeights[static_cast<unsigned long long>(index)*
+            psqtBuckets+k];
       }
-#ifdef USE_MMX
-      _mm_empty();
+      for (const auto index : added){
+        const IndexType offset=HalfDimensions*index;
+        for (IndexType j=0; j<HalfDimensions; ++j)
+          entry.accumulation[j]=
+            static_cast<std::int16_t>(entry.accumulation[j]+
+              static_cast<std::int16_t>(weights[offset+j]));
+        for (std::size_t k=0; k<psqtBuckets; ++k)
+          entry.psqtAccumulation[k]+=psqtWeights[static_cast<unsigned long long>(index)*
+            psqtBuckets+k];
+      }
+      std::memcpy(accumulation[perspective],entry.accumulation,
+        HalfDimensions*sizeof(BiasType));
+      std::memcpy(psqtAccumulation[perspective],entry.psqtAccumulation,
+        psqtBuckets*sizeof(PsqtWeightType));
 #endif
+      for (const Color c : {WHITE,BLACK})
+        entry.byColorBB[c]=pos.pieces(c);
+      for (PieceType pt=PAWN; pt<=KING; ++pt)
+        entry.byTypeBB[pt]=pos.pieces(pt);
     }
 
     alignas(cacheLineSize) BiasType biases[HalfDimensions];
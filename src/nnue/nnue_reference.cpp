@@ -0,0 +1,14 @@
+// The network code once more without any vector extension, only the scalar
+// branches of the layers and of the feature transformer. It is the target
+// the nnuecheck command compares the SIMD paths of the build against.
+#undef USE_AVX512
+#undef USE_VNNI
+#undef USE_AVXVNNI
+#undef USE_AVX2
+#undef USE_SSE41
+#undef USE_SSSE3
+#undef USE_SSE2
+#undef USE_MMX
+#undef USE_NEON
+#define NNUE_TARGET scalar
+#include "evaluate_nnue.cpp"
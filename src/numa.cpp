@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "numa.h"
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <sched.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#define USE_NUMA
+#endif
+using std::string;
+
+namespace Nebula::Numa{
+  namespace{
+    std::vector<std::vector<int>> nodeCpus(1);
+    std::vector<int> nodeIds(1,0);
+    NumaPolicy currentPolicy=NumaPolicy::None;
+    size_t active=1;
+
+    std::vector<int> parseCpuList(const string& list){
+      std::vector<int> cpus;
+      std::istringstream ss(list);
+      string range;
+      while (std::getline(ss,range,',')){
+        if (range.empty())
+          continue;
+        const size_t dash=range.find('-');
+        const int first=std::stoi(range.substr(0,dash));
+        const int last=dash==string::npos?first:std::stoi(range.substr(dash+1));
+        for (int c=first; c<=last; ++c)
+          cpus.push_back(c);
+      }
+      return cpus;
+    }
+  }
+
+  void init(){
+    nodeCpus.assign(1,{});
+    nodeIds.assign(1,0);
+#ifdef USE_NUMA
+    std::ifstream online("/sys/devices/system/node/online");
+    string list;
+    if (online&&std::getline(online,list)){
+      std::vector<std::vector<int>> cpusFound;
+      std::vector<int> idsFound;
+      for (const int n : parseCpuList(list)){
+        std::ifstream f("/sys/devices/system/node/node"+std::to_string(n)+"/cpulist");
+        if (string cpuList; f&&std::getline(f,cpuList))
+          if (std::vector<int> cpus=parseCpuList(cpuList); !cpus.empty()){
+            cpusFound.push_back(cpus);
+            idsFound.push_back(n);
+          }
+      }
+      if (!cpusFound.empty()){
+        nodeCpus=cpusFound;
+        nodeIds=idsFound;
+      }
+    }
+#endif
+    active=nodeCpus.size();
+  }
+
+  void setPolicy(const NumaPolicy p){ currentPolicy=p; }
+  NumaPolicy policy(){ return currentPolicy; }
+  size_t nodeCount(){ return nodeCpus.size(); }
+  size_t cpusOnNode(const size_t node){ return std::max<size_t>(1,nodeCpus[node].size()); }
+  void setActiveNodes(const size_t n){ active=std::clamp<size_t>(n,1,nodeCpus.size()); }
+  size_t activeNodes(){ return active; }
+  size_t nodeFor(const size_t threadIdx){ return threadIdx%active; }
+
+  void bindThisThread(const size_t threadIdx){
+#ifdef USE_NUMA
+    if (currentPolicy==NumaPolicy::None||nodeCpus[0].empty())
+      return;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (const int c : nodeCpus[nodeFor(threadIdx)])
+      CPU_SET(c,&mask);
+    sched_setaffinity(0,sizeof(cpu_set_t),&mask);
+#else
+    (void)threadIdx;
+#endif
+  }
+
+  void interleave(void* mem, const size_t size, const bool move){
+#ifdef USE_NUMA
+    const bool interleaved=currentPolicy==NumaPolicy::Interleave&&active>1;
+    if (nodeCpus.size()<2||(!interleaved&&!move))
+      return;
+    if (!interleaved){
+      syscall(SYS_mbind,mem,size,MPOL_DEFAULT,nullptr,0,0);
+      return;
+    }
+    unsigned long nodeMask=0;
+    for (size_t n=0; n<active; ++n)
+      if (nodeIds[n]<static_cast<int>(8*sizeof(nodeMask)))
+        nodeMask|=1UL<<nodeIds[n];
+    syscall(SYS_mbind,mem,size,MPOL_INTERLEAVE,&nodeMask,8*sizeof(nodeMask),move?MPOL_MF_MOVE:0);
+#else
+    (void)mem;
+    (void)size;
+    (void)move;
+#endif
+  }
+
+  string info(){
+    std::stringstream ss;
+    ss<<"NUMA nodes "<<nodeCount()<<" active "<<active<<" cpus";
+    for (size_t n=0; n<nodeCount(); ++n)
+      ss<<(n?"/":" ")<<nodeCpus[n].size();
+    return ss.str();
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace Nebula{
+  enum class NumaPolicy :uint8_t{ None, Bind, Interleave };
+
+  namespace Numa{
+    void init();
+    void setPolicy(NumaPolicy p);
+    [[nodiscard]] NumaPolicy policy();
+    [[nodiscard]] size_t nodeCount();
+    [[nodiscard]] size_t cpusOnNode(size_t node);
+    void setActiveNodes(size_t n);
+    [[nodiscard]] size_t activeNodes();
+    [[nodiscard]] size_t nodeFor(size_t threadIdx);
+    void bindThisThread(size_t threadIdx);
+    // Spreads mem over the active nodes under the interleave policy. With
+    // move the pages already touched migrate too, and memory of any other
+    // policy goes back to the default placement.
+    void interleave(void* mem, size_t size, bool move=false);
+    [[nodiscard]] std::string info();
+  }
+}
@@ -4,11 +4,11 @@
 #include <iomanip>
 #include <sstream>
 #include "bitboard.h"
+#include "engine.h"
 #include "misc.h"
 #include "movegen.h"
 #include "position.h"
 #include "thread.h"
-#include "tt.h"
 #include "uci.h"
 using std::string;
 
@@ -123,6 +123,73 @@ namespace Nebula{
     return *this;
   }
 
+  // Whether set() can take fenStr: a full board with one king and at most
+  // 16 pieces a side, no pawns on the back ranks, a rook for every castling
+  // right and the side not to move not in check.
+  bool Position::validFen(const string& fenStr){
+    std::istringstream ss(fenStr);
+    string board, side, castling="-", ep;
+    long long rule50=0, moveNumber=1;
+    ss>>board>>side>>castling>>ep>>rule50>>moveNumber;
+    Piece squares[SQUARE_NB]={};
+    int count[PIECE_NB]={};
+    int rank=7, file=0;
+    for (const char ch : board){
+      size_t idx;
+      if (ch=='/'){
+        if (file!=8||rank==0)
+          return false;
+        --rank;
+        file=0;
+      }
+      else if (ch>='1'&&ch<='8')
+        file+=ch-'0';
+      else if (ch!=' '&&(idx=pieceToChar.find(ch))!=string::npos&&file<8){
+        const auto pc=static_cast<Piece>(idx);
+        if (typeOf(pc)==PAWN&&(rank==0||rank==7))
+          return false;
+        squares[makeSquare(static_cast<File>(file++),static_cast<Rank>(rank))]=pc;
+        ++count[pc];
+      }
+      else
+        return false;
+      if (file>8)
+        return false;
+    }
+    if (rank||file!=8||(side!="w"&&side!="b")||rule50<0||moveNumber<0||moveNumber>1000000)
+      return false;
+    for (const Color c : {WHITE,BLACK}){
+      int total=0;
+      for (PieceType pt=PAWN; pt<=KING; ++pt)
+        total+=count[makePiece(c,pt)];
+      if (count[makePiece(c,KING)]!=1||count[makePiece(c,PAWN)]>8||total>16)
+        return false;
+    }
+    for (const char ch : castling=="-"?string():castling){
+      const Color c=islower(ch)?BLACK:WHITE;
+      const char token=static_cast<char>(toupper(ch));
+      const Rank r=relativeRank(c,RANK_1);
+      bool king=false, rookBefore=false, rookAfter=false;
+      for (File f=FILE_A; f<=FILE_H; ++f){
+        const Piece pc=squares[makeSquare(f,r)];
+        king|=pc==makePiece(c,KING);
+        rookBefore|=pc==makePiece(c,ROOK)&&!king;
+        rookAfter|=pc==makePiece(c,ROOK)&&king;
+      }
+      if (!king
+        ||(token=='K'&&!rookAfter)
+        ||(token=='Q'&&!rookBefore)
+        ||(token>='A'&&token<='H'
+          &&squares[makeSquare(static_cast<File>(token-'A'),r)]!=makePiece(c,ROOK))
+        ||(token!='K'&&token!='Q'&&(token<'A'||token>'H')))
+        return false;
+    }
+    StateInfo st;
+    Position pos;
+    pos.set(fenStr,false,&st,nullptr);
+    return !(pos.attackersTo(pos.square<KING>(~pos.stm()))&pos.pieces(pos.stm()));
+  }
+
   void Position::setCastlingRight(const Color c, const Square rfrom){
     const Square kfrom=square<KING>(c);
     const CastlingRights cr=c&(kfrom<rfrom?KING_SIDE:QUEEN_SIDE);
@@ -208,7 +275,7 @@ namespace Nebula{
       ss<<(chess960?static_cast<char>('a'+fileOf(castleRookSquare(BLACK_OOO))):'q');
     if (!canCastle(ANY_CASTLING))
       ss<<'-';
-    ss<<(epSquare()==SQ_NONE?" - ":" "+Uci::square(epSquare())+" ")
+    ss<<' '<<(epSquare()==SQ_NONE?"-":Uci::square(epSquare()))<<' '
       <<st->rule50<<" "<<1+(gamePly-(sideToMove==BLACK))/2;
     return ss.str();
   }
@@ -356,10 +423,9 @@ namespace Nebula{
     newSt.previous=st;
     st=&newSt;
     ++gamePly;
+    ++accIdx;
     ++st->rule50;
     ++st->pliesFromNull;
-    st->accumulator.computed[WHITE]=false;
-    st->accumulator.computed[BLACK]=false;
     auto& dp=st->dirtyPiece;
     dp.dirty_num=1;
     const Color us=sideToMove;
@@ -477,6 +543,7 @@ namespace Nebula{
     }
     st=st->previous;
     --gamePly;
+    --accIdx;
   }
 
   template <bool Do>
@@ -503,20 +570,19 @@ namespace Nebula{
   }
 
   void Position::doNullMove(StateInfo& newSt){
-    std::memcpy(&newSt,st, offsetof(StateInfo,accumulator));
+    std::memcpy(&newSt,st, offsetof(StateInfo,dirtyPiece));
     newSt.previous=st;
     st=&newSt;
+    ++accIdx;
     st->dirtyPiece.dirty_num=0;
     st->dirtyPiece.piece[0]=NO_PIECE;
-    st->accumulator.computed[WHITE]=false;
-    st->accumulator.computed[BLACK]=false;
     if (st->epSquare!=SQ_NONE){
       st->key^=Zobrist::enpassant[fileOf(st->epSquare)];
       st->epSquare=SQ_NONE;
     }
     st->key^=Zobrist::side;
     ++st->rule50;
-    prefetch(tt.firstEntry(key()));
+    prefetch(thisThread->engine.tt.firstEntry(key()));
     st->pliesFromNull=0;
     sideToMove=~sideToMove;
     setCheckInfo(st);
@@ -525,6 +591,7 @@ namespace Nebula{
 
   void Position::undoNullMove(){
     st=st->previous;
+    --accIdx;
     sideToMove=~sideToMove;
   }
 
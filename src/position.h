@@ -22,7 +22,6 @@ namespace Nebula{
     uint64_t checkSquares[PIECE_TYPE_NB];
     Piece capturedPiece;
     int repetition;
-    Eval::Nnue::Accumulator accumulator;
     DirtyPiece dirtyPiece;
   };
 
@@ -37,6 +36,7 @@ namespace Nebula{
     Position& operator=(const Position&) = delete;
     Position& set(const std::string& fenStr, bool isChess960, StateInfo* si, Thread* th);
     Position& set(const std::string& code, Color c, StateInfo* si);
+    [[nodiscard]] static bool validFen(const std::string& fenStr);
     [[nodiscard]] std::string fen() const;
     [[nodiscard]] uint64_t pieces(PieceType pt) const;
     [[nodiscard]] uint64_t pieces(PieceType pt1, PieceType pt2) const;
@@ -95,6 +95,7 @@ namespace Nebula{
     [[nodiscard]] Value nonPawnMaterial(Color c) const;
     [[nodiscard]] Value nonPawnMaterial() const;
     [[nodiscard]] StateInfo* state() const;
+    [[nodiscard]] int accumulatorIndex() const;
     void putPiece(Piece pc, Square s);
     void removePiece(Square s);
   private:
@@ -116,6 +117,7 @@ namespace Nebula{
     Thread* thisThread;
     StateInfo* st;
     int gamePly;
+    int accIdx;
     Color sideToMove;
     bool chess960;
   };
@@ -243,4 +245,5 @@ namespace Nebula{
 
   inline void Position::doMove(const Move m, StateInfo& newSt){ doMove(m,newSt,givesCheck(m)); }
   inline StateInfo* Position::state() const{ return st; }
+  inline int Position::accumulatorIndex() const{ return accIdx; }
 }
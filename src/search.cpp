@@ -3,6 +3,7 @@
 #include <cstring>
 #include <iostream>
 #include <sstream>
+#include "engine.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "movegen.h"
@@ -15,10 +16,6 @@
 #include "uci.h"
 
 namespace Nebula{
-  namespace Search{
-    LimitsType limits;
-  }
-
   using std::string;
   using Eval::evaluate;
   using namespace Search;
@@ -27,11 +24,10 @@ namespace Nebula{
     enum NodeType :uint8_t{ NonPV, PV, Root };
 
     Value futilityMargin(const Depth d, const bool improving){ return static_cast<Value>(168*(d-improving)); }
-    int reductions[maxMoves];
 
-    Depth reduction(const bool i, const Depth d, const int mn, const Value delta, const Value rootDelta){
-      const int r=reductions[d]*reductions[mn];
-      return (r+1463-static_cast<int>(delta)*1024/static_cast<int>(rootDelta))/1024+(!i&&r>1010);
+    Depth reduction(const Thread* th, const bool i, const Depth d, const int mn, const Value delta){
+      const int r=th->reductions[d]*th->reductions[mn];
+      return (r+1463-static_cast<int>(delta)*1024/static_cast<int>(th->rootDelta))/1024+(!i&&r>1010);
     }
 
     constexpr int futilityMoveCount(const bool improving, const Depth depth){
@@ -42,6 +38,24 @@ namespace Nebula{
 
     int statBonus(const Depth d){ return std::min((8*d+240)*d-276,1907); }
     Value valueDraw(const Thread* thisThread){ return VALUE_DRAW-1+static_cast<Value>(thisThread->nodes&0x2); }
+
+    // Only the thread itself writes its counters, so no locked increment
+    void countTtProbe(Thread* th, const bool hit){
+      th->ttProbes.store(th->ttProbes.load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+      th->ttHits.store(th->ttHits.load(std::memory_order_relaxed)+hit,std::memory_order_relaxed);
+    }
+
+    void addStat([[maybe_unused]] Thread* th, [[maybe_unused]] uint64_t Stats::* counter, [[maybe_unused]] const uint64_t n=1){
+#ifdef USE_SEARCH_STATS
+      th->stats.*counter+=n;
+#endif
+    }
+
+    void addStage([[maybe_unused]] Thread* th, [[maybe_unused]] const MovePicker& mp){
+#ifdef USE_SEARCH_STATS
+      ++th->stats.stages[mp.stageReached()];
+#endif
+    }
     template <NodeType nodeType>
     Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode);
     template <NodeType nodeType>
@@ -56,34 +70,38 @@ namespace Nebula{
       Depth depth);
   }
 
-  void Search::init(){
-    for (int i=1; i<maxMoves; ++i)
-      reductions[i]=static_cast<int>((20.81+std::log(threads.size())/2)*std::log(i));
+  void Search::init(ThreadPool& threads){
+    for (Thread* th : threads)
+      for (int i=1; i<maxMoves; ++i)
+        th->reductions[i]=static_cast<int>((20.81+std::log(threads.size())/2)*std::log(i));
   }
 
-  void Search::clear(){
-    threads.main()->waitForSearchFinished();
-    time.availableNodes=0;
-    tt.clear();
-    threads.clear();
+  void Search::clear(Engine& engine){
+    engine.threads.main()->waitForSearchFinished();
+    engine.time.availableNodes=0;
+    engine.tt.clear(engine.options["BackgroundClear"].asBool());
+    engine.threads.clear();
   }
 
   void MainThread::search(){
+    ThreadPool& threads=engine.threads;
+    TimeManagement& time=engine.time;
+    LimitsType& limits=engine.limits;
     const Color us=rootPos.stm();
     time.init(limits,us,rootPos.gameply());
-    tt.newSearch();
+    engine.tt.newSearch();
     if (rootMoves.empty()){ rootMoves.emplace_back(MOVE_NONE); }
     else{
       threads.startSearching();
       Thread::search();
     }
-    while (!threads.stop&&(ponder||limits.infinite)){}
+    waitForStop();
     threads.stop=true;
     threads.waitForSearchFinished();
     if (limits.npmsec)
       time.availableNodes+=static_cast<int64_t>(limits.inc[us]-threads.nodesSearched());
     Thread* bestThread=this;
-    if (options["MultiPV"].asInt()==1
+    if (engine.options["MultiPV"].asInt()==1
       &&!limits.depth
       &&rootMoves[0].pv[0]!=MOVE_NONE)
       bestThread=threads.getBestThread();
@@ -92,14 +110,16 @@ namespace Nebula{
     for (Thread* th : threads)
       th->previousDepth=bestThread->completedDepth;
     if (bestThread!=this)
-      async()<<Uci::pv(bestThread->rootPos,bestThread->completedDepth)<<std::endl;
-    async()<<"bestmove "<<Uci::move(bestThread->rootMoves[0].pv[0],rootPos.isChess960());
-    if (bestThread->rootMoves[0].pv.size()>1||bestThread->rootMoves[0].extractPonderFromTt(rootPos))
-      async()<<" ponder "<<Uci::move(bestThread->rootMoves[0].pv[1],rootPos.isChess960());
-    async()<<std::endl;
+      engine.onPv(bestThread->rootPos,bestThread->completedDepth);
+    RootMove& best=bestThread->rootMoves[0];
+    const bool hasPonder=best.pv.size()>1||best.extractPonderFromTt(rootPos);
+    engine.onBestMove(rootPos,best.pv[0],hasPonder?best.pv[1]:MOVE_NONE);
   }
 
   void Thread::search(){
+    ThreadPool& threads=engine.threads;
+    const TimeManagement& time=engine.time;
+    const LimitsType& limits=engine.limits;
     std::unique_ptr<Stack[]> stack(new Stack[maxPly + 10]);
     Stack* ss=stack.get() + 7;
     Move pv[maxPly+1];
@@ -126,7 +146,7 @@ namespace Nebula{
         for (auto& i : mainThread->iterValue)
           i=mainThread->bestPreviousScore;
     }
-    size_t multiPv=std::max<size_t>(1,options["MultiPV"].asSize());
+    size_t multiPv=std::max<size_t>(1,engine.options["MultiPV"].asSize());
     multiPv=std::min(multiPv,rootMoves.size());
     complexityAverage.set(174,1);
     trend=SCORE_ZERO;
@@ -183,7 +203,7 @@ namespace Nebula{
             &&multiPv==1
             &&(bestValue<=alpha||bestValue>=beta)
             &&time.elapsed()>3000)
-            async()<<Uci::pv(rootPos,rootDepth)<<std::endl;
+            engine.onPv(rootPos,rootDepth);
           if (bestValue<=alpha){
             beta=(alpha+beta)/2;
             alpha=std::max(bestValue-delta,-VALUE_INFINITE);
@@ -205,7 +225,7 @@ namespace Nebula{
 
         if (mainThread
           &&(threads.stop||pvIdx+1==multiPv||time.elapsed()>3000))
-          async()<<Uci::pv(rootPos,rootDepth)<<std::endl;
+          engine.onPv(rootPos,rootDepth);
       }
       if (!threads.stop)
         completedDepth=rootDepth;
@@ -278,6 +298,7 @@ namespace Nebula{
       Move pv[maxPly+1], capturesSearched[32], quietsSearched[64];
       StateInfo st;
       TtEntry* tte;
+      TtData ttData;
       uint64_t posKey;
       Move ttMove, move, excludedMove, bestMove;
       Depth extension, newDepth;
@@ -287,6 +308,8 @@ namespace Nebula{
       Piece movedPiece;
       int moveCount, captureCount, quietCount, improvement, complexity;
       Thread* thisThread=pos.thisthread();
+      ThreadPool& threads=thisThread->engine.threads;
+      TranspositionTable& tt=thisThread->engine.tt;
       ss->inCheck=pos.checkers();
       priorCapture=pos.capturedPiece();
       Color us=pos.stm();
@@ -319,21 +342,24 @@ namespace Nebula{
         (ss+2)->statScore=0;
       excludedMove=ss->excludedMove;
       posKey=excludedMove==MOVE_NONE?pos.key():pos.key()^makeKey(excludedMove);
-      tte=tt.probe(posKey,ss->ttHit);
-      ttValue=ss->ttHit?valueFromTt(tte->value(),ss->ply,pos.rule50Count()):VALUE_NONE;
+      tte=tt.probe(posKey,ss->ttHit,ttData);
+      countTtProbe(thisThread,ss->ttHit);
+      addStat(thisThread,&Stats::ttProbes);
+      addStat(thisThread,&Stats::ttHits,ss->ttHit);
+      ttValue=ss->ttHit?valueFromTt(ttData.value,ss->ply,pos.rule50Count()):VALUE_NONE;
       ttMove=rootNode
              ?thisThread->rootMoves[thisThread->pvIdx].pv[0]
              :ss->ttHit
-             ?tte->move()
+             ?ttData.move
              :MOVE_NONE;
       ttCapture=ttMove&&pos.capture(ttMove);
       if (!excludedMove)
-        ss->ttPv=pvNode||(ss->ttHit&&tte->isPv());
+        ss->ttPv=pvNode||(ss->ttHit&&ttData.isPv);
       if (!pvNode
         &&ss->ttHit
-        &&tte->depth()>depth-(tte->bound()==BOUND_EXACT)
+        &&ttData.depth>depth-(ttData.bound==BOUND_EXACT)
         &&ttValue!=VALUE_NONE
-        &&tte->bound()&(ttValue>=beta?BOUND_LOWER:BOUND_UPPER)){
+        &&ttData.bound&(ttValue>=beta?BOUND_LOWER:BOUND_UPPER)){
         if (ttMove){
           if (ttValue>=beta){
             if (!ttCapture)
@@ -347,8 +373,10 @@ namespace Nebula{
             updateContinuationHistories(ss,pos.movedPiece(ttMove),toSq(ttMove),penalty);
           }
         }
-        if (pos.rule50Count()<90)
+        if (pos.rule50Count()<90){
+          addStat(thisThread,&Stats::ttCutoffs);
           return ttValue;
+        }
       }
       CapturePieceToHistory& captureHistory=thisThread->captureHistory;
       if (ss->inCheck){
@@ -359,19 +387,19 @@ namespace Nebula{
         goto moves_loop;
       }
       if (ss->ttHit){
-        ss->staticEval=eval=tte->eval();
+        ss->staticEval=eval=ttData.eval;
         if (eval==VALUE_NONE)
           ss->staticEval=eval=evaluate(pos,&complexity);
         else
           complexity=abs(ss->staticEval);
         if (ttValue!=VALUE_NONE
-          &&tte->bound()&(ttValue>eval?BOUND_LOWER:BOUND_UPPER))
+          &&ttData.bound&(ttValue>eval?BOUND_LOWER:BOUND_UPPER))
           eval=ttValue;
       }
       else{
         ss->staticEval=eval=evaluate(pos,&complexity);
         if (!excludedMove)
-          tte->save(posKey,VALUE_NONE,ss->ttPv,BOUND_NONE,DEPTH_NONE,MOVE_NONE,eval);
+          tte->save(posKey,VALUE_NONE,ss->ttPv,BOUND_NONE,DEPTH_NONE,MOVE_NONE,eval,tt.generation());
       }
       thisThread->complexityAverage.update(complexity);
       if (isOk((ss-1)->currentMove)&&!(ss-1)->inCheck&&!priorCapture){
@@ -394,8 +422,10 @@ namespace Nebula{
         &&depth<8
         &&eval-futilityMargin(depth,improving)-(ss-1)->statScore/256>=beta
         &&eval>=beta
-        &&eval<26305)
+        &&eval<26305){
+        addStat(thisThread,&Stats::futilityPrunes);
         return eval;
+      }
       if (!pvNode
         &&(ss-1)->currentMove!=MOVE_NULL
         &&(ss-1)->statScore<14695
@@ -406,6 +436,7 @@ namespace Nebula{
         &&pos.nonPawnMaterial(us)
         &&(ss->ply>=thisThread->nmpMinPly||us!=thisThread->nmpColor)){
         Depth R=std::min(static_cast<int>(eval-beta)/147,5)+depth/3+4-(complexity>650);
+        addStat(thisThread,&Stats::nmpTries);
         ss->currentMove=MOVE_NULL;
         ss->continuationHistory=&thisThread->continuationHistory[0][0][NO_PIECE][0];
         pos.doNullMove(st);
@@ -414,14 +445,18 @@ namespace Nebula{
         if (nullValue>=beta){
           if (nullValue>=VALUE_TB_WIN_IN_MAX_PLY)
             nullValue=beta;
-          if (thisThread->nmpMinPly||(abs(beta)<VALUE_KNOWN_WIN&&depth<14))
+          if (thisThread->nmpMinPly||(abs(beta)<VALUE_KNOWN_WIN&&depth<14)){
+            addStat(thisThread,&Stats::nmpCutoffs);
             return nullValue;
+          }
           thisThread->nmpMinPly=ss->ply+3*(depth-R)/4;
           thisThread->nmpColor=us;
           Value v=search<NonPV>(pos,ss,beta-1,beta,depth-R,false);
           thisThread->nmpMinPly=0;
-          if (v>=beta)
+          if (v>=beta){
+            addStat(thisThread,&Stats::nmpCutoffs);
             return nullValue;
+          }
         }
       }
       probCutBeta=beta+179-46*improving;
@@ -429,7 +464,7 @@ namespace Nebula{
         &&depth>4
         &&abs(beta)<VALUE_TB_WIN_IN_MAX_PLY
         &&!(ss->ttHit
-          &&tte->depth()>=depth-3
+          &&ttData.depth>=depth-3
           &&ttValue!=VALUE_NONE
           &&ttValue<probCutBeta)){
         MovePicker mp(pos,ttMove,probCutBeta-ss->staticEval,depth-3,&captureHistory);
@@ -446,7 +481,8 @@ namespace Nebula{
               value=-search<NonPV>(pos,ss+1,-probCutBeta,-probCutBeta+1,depth-4,!cutNode);
             pos.undoMove(move);
             if (value>=probCutBeta){
-              tte->save(posKey,valueToTt(value,ss->ply),ss->ttPv,BOUND_LOWER,depth-3,move,ss->staticEval);
+              tte->save(posKey,valueToTt(value,ss->ply),ss->ttPv,BOUND_LOWER,depth-3,move,ss->staticEval,tt.generation());
+              addStat(thisThread,&Stats::probCutCutoffs);
               return value;
             }
           }
@@ -466,8 +502,8 @@ namespace Nebula{
         &&!pvNode
         &&depth>=2
         &&ttCapture
-        &&tte->bound()&BOUND_LOWER
-        &&tte->depth()>=depth-3
+        &&ttData.bound&BOUND_LOWER
+        &&ttData.depth>=depth-3
         &&ttValue>=probCutBeta
         &&abs(ttValue)<=VALUE_KNOWN_WIN
         &&abs(beta)<=VALUE_KNOWN_WIN
@@ -487,8 +523,8 @@ namespace Nebula{
       moveCountPruning=singularQuietLmr=false;
       bool likelyFailLow=pvNode
         &&ttMove
-        &&tte->bound()&BOUND_UPPER
-        &&tte->depth()>=depth;
+        &&ttData.bound&BOUND_UPPER
+        &&ttData.depth>=depth;
       while ((move=mp.nextMove(moveCountPruning))!=MOVE_NONE){
         if (move==excludedMove)
           continue;
@@ -517,7 +553,7 @@ namespace Nebula{
           &&pos.nonPawnMaterial(us)
           &&bestValue>VALUE_TB_LOSS_IN_MAX_PLY){
           moveCountPruning=moveCount>=futilityMoveCount(improving,depth);
-          int lmrDepth=std::max(newDepth-reduction(improving,depth,moveCount,delta,thisThread->rootDelta),0);
+          int lmrDepth=std::max(newDepth-reduction(thisThread,improving,depth,moveCount,delta),0);
           if (capture
             ||givesCheck){
             if (!pos.empty(toSq(move))
@@ -541,20 +577,22 @@ namespace Nebula{
             history+=2*thisThread->mainHistory[us][fromTo(move)];
             if (!ss->inCheck
               &&lmrDepth<11
-              &&ss->staticEval+122+138*lmrDepth+history/60<=alpha)
+              &&ss->staticEval+122+138*lmrDepth+history/60<=alpha){
+              addStat(thisThread,&Stats::futilityPrunes);
               continue;
+            }
             if (!pos.seeGe(move,static_cast<Value>(-25*lmrDepth*lmrDepth-20*lmrDepth)))
               continue;
           }
         }
         if (ss->ply<thisThread->rootDepth*2){
           if (!rootNode
-            &&depth>=4-(thisThread->previousDepth>27)+2*(pvNode&&tte->isPv())
+            &&depth>=4-(thisThread->previousDepth>27)+2*(pvNode&&ttData.isPv)
             &&move==ttMove
             &&!excludedMove
             &&abs(ttValue)<VALUE_KNOWN_WIN
-            &&tte->bound()&BOUND_LOWER
-            &&tte->depth()>=depth-3){
+            &&ttData.bound&BOUND_LOWER
+            &&ttData.depth>=depth-3){
             Value singularBeta=ttValue-3*depth;
             Depth singularDepth=(depth-1)/2;
             ss->excludedMove=move;
@@ -599,7 +637,7 @@ namespace Nebula{
           &&(!ss->ttPv
             ||!capture
             ||(cutNode&&(ss-1)->moveCount>1))){
-          Depth r=reduction(improving,depth,moveCount,delta,thisThread->rootDelta);
+          Depth r=reduction(thisThread,improving,depth,moveCount,delta);
           if (ss->ttPv
             &&!likelyFailLow)
             r-=2;
@@ -625,6 +663,7 @@ namespace Nebula{
           value=-search<NonPV>(pos,ss+1,-(alpha+1),-alpha,d,true);
           if (value>alpha&&d<newDepth){
             const bool doDeeperSearch=value>alpha+78+11*(newDepth-d);
+            addStat(thisThread,&Stats::lmrResearches);
             value=-search<NonPV>(pos,ss+1,-(alpha+1),-alpha,newDepth+doDeeperSearch,!cutNode);
             int bonus=value>alpha
                       ?statBonus(newDepth)
@@ -689,6 +728,7 @@ namespace Nebula{
             quietsSearched[quietCount++]=move;
         }
       }
+      addStage(thisThread,mp);
       if (!moveCount)
         bestValue=excludedMove
                   ?alpha
@@ -712,7 +752,7 @@ namespace Nebula{
       if (!excludedMove&&!(rootNode&&thisThread->pvIdx))
         tte->save(posKey,valueToTt(bestValue,ss->ply),ss->ttPv,
           bestValue>=beta?BOUND_LOWER:pvNode&&bestMove?BOUND_EXACT:BOUND_UPPER,
-          depth,bestMove,ss->staticEval);
+          depth,bestMove,ss->staticEval,tt.generation());
       return bestValue;
     }
 
@@ -728,7 +768,9 @@ namespace Nebula{
         ss->pv[0]=MOVE_NONE;
       }
       Thread* thisThread=pos.thisthread();
+      TranspositionTable& tt=thisThread->engine.tt;
       Move bestMove=MOVE_NONE;
+      addStat(thisThread,&Stats::qsearchNodes);
       ss->inCheck=pos.checkers();
       int moveCount=0;
       if (pos.isDraw(ss->ply)
@@ -738,26 +780,32 @@ namespace Nebula{
                           ?DEPTH_QS_CHECKS
                           :DEPTH_QS_NO_CHECKS;
       const uint64_t posKey=pos.key();
-      TtEntry* tte=tt.probe(posKey,ss->ttHit);
-      const Value ttValue=ss->ttHit?valueFromTt(tte->value(),ss->ply,pos.rule50Count()):VALUE_NONE;
-      const Move ttMove=ss->ttHit?tte->move():MOVE_NONE;
-      const bool pvHit=ss->ttHit&&tte->isPv();
+      TtData ttData;
+      TtEntry* tte=tt.probe(posKey,ss->ttHit,ttData);
+      countTtProbe(thisThread,ss->ttHit);
+      addStat(thisThread,&Stats::ttProbes);
+      addStat(thisThread,&Stats::ttHits,ss->ttHit);
+      const Value ttValue=ss->ttHit?valueFromTt(ttData.value,ss->ply,pos.rule50Count()):VALUE_NONE;
+      const Move ttMove=ss->ttHit?ttData.move:MOVE_NONE;
+      const bool pvHit=ss->ttHit&&ttData.isPv;
       if (!pvNode
         &&ss->ttHit
-        &&tte->depth()>=ttDepth
+        &&ttData.depth>=ttDepth
         &&ttValue!=VALUE_NONE
-        &&tte->bound()&(ttValue>=beta?BOUND_LOWER:BOUND_UPPER))
+        &&ttData.bound&(ttValue>=beta?BOUND_LOWER:BOUND_UPPER)){
+        addStat(thisThread,&Stats::ttCutoffs);
         return ttValue;
+      }
       if (ss->inCheck){
         ss->staticEval=VALUE_NONE;
         bestValue=futilityBase=-VALUE_INFINITE;
       }
       else{
         if (ss->ttHit){
-          if ((ss->staticEval=bestValue=tte->eval())==VALUE_NONE)
+          if ((ss->staticEval=bestValue=ttData.eval)==VALUE_NONE)
             ss->staticEval=bestValue=evaluate(pos);
           if (ttValue!=VALUE_NONE
-            &&tte->bound()&(ttValue>bestValue?BOUND_LOWER:BOUND_UPPER))
+            &&ttData.bound&(ttValue>bestValue?BOUND_LOWER:BOUND_UPPER))
             bestValue=ttValue;
         }
         else
@@ -768,7 +816,7 @@ namespace Nebula{
         if (bestValue>=beta){
           if (!ss->ttHit)
             tte->save(posKey,valueToTt(bestValue,ss->ply),false,BOUND_LOWER,
-              DEPTH_NONE,MOVE_NONE,ss->staticEval);
+              DEPTH_NONE,MOVE_NONE,ss->staticEval,tt.generation());
           return bestValue;
         }
         if (pvNode&&bestValue>alpha)
@@ -801,10 +849,12 @@ namespace Nebula{
             continue;
           if (Value futilityValue=futilityBase+pieceValue[EG][pos.pieceOn(toSq(move))]; futilityValue<=alpha){
             bestValue=std::max(bestValue,futilityValue);
+            addStat(thisThread,&Stats::futilityPrunes);
             continue;
           }
           if (futilityBase<=alpha&&!pos.seeGe(move,VALUE_ZERO+1)){
             bestValue=std::max(bestValue,futilityBase);
+            addStat(thisThread,&Stats::futilityPrunes);
             continue;
           }
         }
@@ -844,10 +894,11 @@ namespace Nebula{
           }
         }
       }
+      addStage(thisThread,mp);
       if (ss->inCheck&&bestValue==-VALUE_INFINITE){ return matedIn(ss->ply); }
       tte->save(posKey,valueToTt(bestValue,ss->ply),pvHit,
         bestValue>=beta?BOUND_LOWER:BOUND_UPPER,
-        ttDepth,bestMove,ss->staticEval);
+        ttDepth,bestMove,ss->staticEval,tt.generation());
       return bestValue;
     }
 
@@ -941,26 +992,25 @@ namespace Nebula{
   void MainThread::checkTime(){
     if (--callsCnt>0)
       return;
+    const LimitsType& limits=engine.limits;
     callsCnt=limits.nodes?std::min(1024,static_cast<int>(limits.nodes/1024)):1024;
-    static TimePoint lastInfoTime=now();
-    const TimePoint elapsed=time.elapsed();
-    if (const TimePoint tick=limits.startTime+elapsed; tick-lastInfoTime>=1000)
-      lastInfoTime=tick;
+    const TimePoint elapsed=engine.time.elapsed();
     if (ponder)
       return;
-    if ((limits.useTimeManagement()&&(elapsed>time.maximum()-10||stopOnPonderhit))
+    if ((limits.useTimeManagement()&&(elapsed>engine.time.maximum()-10||stopOnPonderhit))
       ||(limits.movetime&&elapsed>=limits.movetime)
-      ||(limits.nodes&&threads.nodesSearched()>=static_cast<uint64_t>(limits.nodes)))
-      threads.stop=true;
+      ||(limits.nodes&&engine.threads.nodesSearched()>=static_cast<uint64_t>(limits.nodes)))
+      engine.threads.stop=true;
   }
 
   string Uci::pv(const Position& pos, const Depth depth){
     std::stringstream ss;
-    const TimePoint elapsed=time.elapsed()+1;
+    Engine& engine=pos.thisthread()->engine;
+    const TimePoint elapsed=engine.time.elapsed()+1;
     const RootMoves& rootMoves=pos.thisthread()->rootMoves;
-    const size_t multiPv=std::min(std::max<size_t>(1,options["MultiPV"].asSize()),
+    const size_t multiPv=std::min(std::max<size_t>(1,engine.options["MultiPV"].asSize()),
       rootMoves.size());
-    const uint64_t nodesSearched=threads.nodesSearched();
+    const uint64_t nodesSearched=engine.threads.nodesSearched();
     for (size_t i=0; i<multiPv; ++i){
       const bool updated=rootMoves[i].score!=-VALUE_INFINITE;
       if (depth==1&&!updated&&i>0)
@@ -988,12 +1038,13 @@ namespace Nebula{
   bool RootMove::extractPonderFromTt(Position& pos){
     StateInfo st;
     bool ttHit;
+    TtData ttData;
     if (pv[0]==MOVE_NONE)
       return false;
     pos.doMove(pv[0],st);
-    const TtEntry* tte=tt.probe(pos.key(),ttHit);
+    pos.thisthread()->engine.tt.probe(pos.key(),ttHit,ttData);
     if (ttHit){
-      if (const Move m=tte->move(); MoveList<LEGAL>(pos).contains(m))
+      if (const Move m=ttData.move; MoveList<LEGAL>(pos).contains(m))
         pv.push_back(m);
     }
     pos.undoMove(pv[0]);
@@ -5,7 +5,9 @@
 #include "types.h"
 
 namespace Nebula{
+  class Engine;
   class Position;
+  struct ThreadPool;
 
   namespace Search{
     constexpr int counterMovePruneThreshold=0;
@@ -48,6 +50,16 @@ namespace Nebula{
 
     using RootMoves = std::vector<RootMove>;
 
+    // Where the nodes of a thread go. Only counted when built with
+    // searchstats=yes, the searchstats command prints the sum over the pool.
+    struct Stats{
+      uint64_t ttProbes, ttHits, ttCutoffs;
+      uint64_t nmpTries, nmpCutoffs, probCutCutoffs;
+      uint64_t lmrResearches, futilityPrunes, qsearchNodes;
+      uint64_t nnueRefreshes, nnueUpdates, nnueSkipped;
+      uint64_t stages[MovePicker::stageCount];
+    };
+
     struct LimitsType{
       LimitsType() : startTime(0){
         time[WHITE]=time[BLACK]=inc[WHITE]=inc[BLACK]=npmsec=movetime=static_cast<TimePoint>(0);
@@ -62,8 +74,7 @@ namespace Nebula{
       int64_t nodes;
     };
 
-    extern LimitsType limits;
-    void init();
-    void clear();
+    void init(ThreadPool& threads);
+    void clear(Engine& engine);
   }
 }
@@ -0,0 +1,225 @@
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "engine.h"
+#include "evaluate.h"
+#include "movegen.h"
+#include "position.h"
+#include "sfkernel.h"
+#include "uci.h"
+using namespace Nebula;
+
+struct sfk_engine{
+  Engine engine;
+  Position pos;
+  StateListPtr states;
+  std::string fen;
+  std::vector<std::string> moves;
+  sfk_info_cb onInfo=nullptr;
+  sfk_bestmove_cb onBestMove=nullptr;
+  void* user=nullptr;
+  sfk_message_cb onMessage=nullptr;
+  void* messageUser=nullptr;
+};
+
+namespace{
+  constexpr auto startFen="rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+  void copyMove(char (&dst)[6], const Move m, const bool chess960){
+    const std::string s=Uci::move(m,chess960);
+    std::memset(dst,0,sizeof(dst));
+    std::memcpy(dst,s.data(),std::min(s.size(),sizeof(dst)-1));
+  }
+
+  void setScore(sfk_info& info, const Value v){
+    if (abs(v)<VALUE_MATE_IN_MAX_PLY)
+      info.score_cp=v*100/PawnValueEg;
+    else
+      info.mate=(v>0?VALUE_MATE-v+1:-VALUE_MATE-v)/2;
+  }
+
+  // Same selection of lines as Uci::pv
+  void reportPv(const sfk_engine* e, const Position& pos, const Depth depth){
+    const Search::RootMoves& rootMoves=pos.thisthread()->rootMoves;
+    const size_t multiPv=std::min(std::max<size_t>(1,e->engine.options.at("MultiPV").asSize()),rootMoves.size());
+    const TimePoint elapsed=e->engine.time.elapsed()+1;
+    const uint64_t nodes=e->engine.threads.nodesSearched();
+    for (size_t i=0; i<multiPv; ++i){
+      const bool updated=rootMoves[i].score!=-VALUE_INFINITE;
+      if (depth==1&&!updated&&i>0)
+        continue;
+      sfk_info info{};
+      Value v=updated?rootMoves[i].score:rootMoves[i].previousScore;
+      if (v==-VALUE_INFINITE)
+        v=VALUE_ZERO;
+      info.depth=updated?depth:std::max(1,depth-1);
+      info.multipv=static_cast<int>(i+1);
+      setScore(info,v);
+      info.nodes=nodes;
+      info.nps=nodes*1000/static_cast<uint64_t>(elapsed);
+      info.time_ms=elapsed;
+      for (const Move m : rootMoves[i].pv){
+        if (info.pv_length==SFK_MAX_PV)
+          break;
+        copyMove(info.pv[info.pv_length++],m,pos.isChess960());
+      }
+      e->onInfo(&info,e->user);
+    }
+  }
+}
+
+extern "C"{
+  sfk_engine* sfk_create(){
+    auto* e=new sfk_engine;
+    e->engine.onPv=[e](const Position& pos, const Depth depth){
+      if (e->onInfo)
+        reportPv(e,pos,depth);
+    };
+    e->engine.onBestMove=[e](const Position& pos, const Move best, const Move ponder){
+      if (!e->onBestMove)
+        return;
+      sfk_bestmove b{};
+      copyMove(b.bestmove,best,pos.isChess960());
+      if (ponder)
+        copyMove(b.ponder,ponder,pos.isChess960());
+      e->onBestMove(&b,e->user);
+    };
+    e->engine.onMessage=[e](const std::string& message){
+      if (e->onMessage)
+        e->onMessage(message.c_str(),e->messageUser);
+    };
+    sfk_set_position(e,nullptr,nullptr,0);
+    return e;
+  }
+
+  void sfk_destroy(sfk_engine* e){
+    if (!e)
+      return;
+    sfk_stop(e);
+    sfk_wait(e);
+    delete e;
+  }
+
+  int sfk_set_option(sfk_engine* e, const char* name, const char* value){
+    if (!e->engine.options.contains(name))
+      return -1;
+    const Thread* main=e->engine.threads.main();
+    Uci::syncEvalFile(e->engine.options);
+    Uci::Option& option=e->engine.options[name];
+    option=value?value:"";
+    if (&option==&e->engine.options["EvalFile"]&&option.asString()!=Eval::currentNnueNetName)
+      return -2;
+    // Threads and NumaPolicy rebuild the pool, so replay the position on
+    // the new main thread.
+    if (e->engine.threads.main()!=main){
+      const std::string fen=e->fen;
+      const std::vector<std::string> moves=e->moves;
+      std::vector<const char*> ptrs;
+      for (const std::string& m : moves)
+        ptrs.push_back(m.c_str());
+      sfk_set_position(e,fen.c_str(),ptrs.data(),ptrs.size());
+    }
+    return 0;
+  }
+
+  void sfk_new_game(sfk_engine* e){ Search::clear(e->engine); }
+
+  void sfk_set_message_callback(sfk_engine* e, const sfk_message_cb on_message, void* user){
+    e->onMessage=on_message;
+    e->messageUser=user;
+  }
+
+  int sfk_set_position(sfk_engine* e, const char* fen, const char* const* moves, const size_t count){
+    e->engine.threads.main()->waitForSearchFinished();
+    if (fen&&!Position::validFen(fen))
+      return -1;
+    e->fen=fen?fen:startFen;
+    e->moves.clear();
+    e->states=std::make_unique<std::deque<StateInfo>>(1);
+    e->pos.set(e->fen,false,&e->states->back(),e->engine.threads.main());
+    for (size_t i=0; i<count; ++i){
+      std::string token=moves[i];
+      const Move m=Uci::toMove(e->pos,token);
+      if (m==MOVE_NONE)
+        return static_cast<int>(i+1);
+      e->moves.emplace_back(token);
+      e->states->emplace_back();
+      e->pos.doMove(m,e->states->back());
+    }
+    return 0;
+  }
+
+  void sfk_search(sfk_engine* e, const sfk_limits* limits, const sfk_info_cb on_info,
+    const sfk_bestmove_cb on_bestmove, void* user){
+    e->engine.threads.main()->waitForSearchFinished();
+    e->onInfo=on_info;
+    e->onBestMove=on_bestmove;
+    e->user=user;
+    Search::LimitsType l;
+    l.startTime=now();
+    if (limits){
+      l.depth=limits->depth;
+      l.nodes=limits->nodes;
+      l.movetime=limits->movetime_ms;
+      l.time[WHITE]=limits->wtime_ms;
+      l.time[BLACK]=limits->btime_ms;
+      l.inc[WHITE]=limits->winc_ms;
+      l.inc[BLACK]=limits->binc_ms;
+      l.movestogo=limits->movestogo;
+      l.mate=limits->mate;
+    }
+    l.infinite=!l.depth&&!l.nodes&&!l.movetime&&!l.useTimeManagement()&&!l.mate;
+    e->engine.threads.startThinking(e->pos,e->states,l,false);
+  }
+
+  void sfk_stop(sfk_engine* e){
+    e->engine.threads.stop=true;
+    e->engine.threads.main()->wake();
+  }
+
+  void sfk_wait(sfk_engine* e){ e->engine.threads.main()->waitForSearchFinished(); }
+
+  int sfk_evaluate(sfk_engine* e){
+    MainThread* main=e->engine.threads.main();
+    main->waitForSearchFinished();
+    main->optimism[WHITE]=main->optimism[BLACK]=VALUE_ZERO;
+    std::shared_lock network(Eval::Nnue::networkMutex);
+    main->syncNetwork();
+    return Eval::evaluate(e->pos)*100/PawnValueEg;
+  }
+
+  int sfk_evaluate_batch(sfk_engine* e, const char* const* fens, const size_t count, int* out){
+    constexpr size_t chunkSize=1024;
+    for (size_t i=0; i<count; ++i)
+      if (!Position::validFen(fens[i]))
+        return static_cast<int>(i+1);
+    MainThread* main=e->engine.threads.main();
+    main->waitForSearchFinished();
+    main->optimism[WHITE]=main->optimism[BLACK]=VALUE_ZERO;
+    std::vector<Position> positions(std::min(count,chunkSize));
+    std::vector<StateInfo> states(positions.size());
+    std::vector<const Position*> batch(positions.size());
+    std::vector<Value> scores(positions.size());
+    std::shared_lock network(Eval::Nnue::networkMutex);
+    main->syncNetwork();
+    for (size_t first=0; first<count; first+=chunkSize){
+      const size_t n=std::min(chunkSize,count-first);
+      for (size_t i=0; i<n; ++i)
+        batch[i]=&positions[i].set(fens[first+i],false,&states[i],main);
+      Eval::evaluate(batch.data(),n,scores.data());
+      for (size_t i=0; i<n; ++i)
+        out[first+i]=scores[i]*100/PawnValueEg;
+    }
+    return 0;
+  }
+
+  uint64_t sfk_perft(sfk_engine* e, const int depth){
+    e->engine.threads.main()->waitForSearchFinished();
+    return depth<=1
+           ?MoveList<LEGAL>(e->pos).size()
+           :perft<false>(e->pos,depth);
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/* C interface of libsfkernel. Every sfk_engine owns its own hash table,
+   threads and options, the network and attack tables are shared. Moves are
+   passed as UCI strings ("e2e4", "e7e8q"). */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SFK_MAX_PV 64
+
+typedef struct sfk_engine sfk_engine;
+
+typedef struct{
+  int depth;
+  int multipv;
+  int score_cp;  /* from the side to move, 0 when mate is set */
+  int mate;      /* moves to mate, negative when getting mated, 0 if none */
+  uint64_t nodes;
+  uint64_t nps;
+  int64_t time_ms;
+  int pv_length;
+  char pv[SFK_MAX_PV][6];
+} sfk_info;
+
+typedef struct{
+  char bestmove[6];
+  char ponder[6];  /* empty when there is no ponder move */
+} sfk_bestmove;
+
+/* Zero fields are unset, a zeroed struct searches until sfk_stop. */
+typedef struct{
+  int depth;
+  int64_t nodes;
+  int64_t movetime_ms;
+  int64_t wtime_ms, btime_ms, winc_ms, binc_ms;
+  int movestogo;
+  int mate;
+} sfk_limits;
+
+typedef void (*sfk_info_cb)(const sfk_info* info, void* user);
+typedef void (*sfk_bestmove_cb)(const sfk_bestmove* best, void* user);
+typedef void (*sfk_message_cb)(const char* message, void* user);
+
+sfk_engine* sfk_create(void);
+void sfk_destroy(sfk_engine* e);
+
+/* Returns 0 on success, -1 for an unknown option. EvalFile replaces the
+   network of every engine in the process, the others drop their caches
+   and take the new EvalFile value on their next call.
+   It returns -2 and keeps the network when the file does not load or any
+   engine of the process is searching. */
+int sfk_set_option(sfk_engine* e, const char* name, const char* value);
+void sfk_new_game(sfk_engine* e);
+/* Receives what sfk_set_option reports, such as "Hash 16 MB using
+   transparent huge pages". Without a callback it is dropped. */
+void sfk_set_message_callback(sfk_engine* e, sfk_message_cb on_message, void* user);
+
+/* fen may be NULL for the start position. Returns 0 on success, -1 for a
+   FEN that is not a legal position, which leaves the position unchanged,
+   or the 1-based index of the first move that is not legal. */
+int sfk_set_position(sfk_engine* e, const char* fen, const char* const* moves, size_t count);
+
+/* Starts a search on the current position and returns immediately. The
+   callbacks run on the engine's main search thread. */
+void sfk_search(sfk_engine* e, const sfk_limits* limits, sfk_info_cb on_info, sfk_bestmove_cb on_bestmove,
+  void* user);
+void sfk_stop(sfk_engine* e);
+void sfk_wait(sfk_engine* e);
+
+/* Static evaluation in centipawns from the side to move. Not to be called
+   while a search is running. */
+int sfk_evaluate(sfk_engine* e);
+/* The same evaluation for count FENs, using the batched evaluator. Returns
+   0, or the 1-based index of the first invalid FEN, with nothing evaluated. */
+int sfk_evaluate_batch(sfk_engine* e, const char* const* fens, size_t count, int* out);
+uint64_t sfk_perft(sfk_engine* e, int depth);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,13 +1,15 @@
 #include <algorithm>
+#include "engine.h"
+#include "evaluate.h"
 #include "movegen.h"
+#include "numa.h"
 #include "search.h"
 #include "thread.h"
 #include "uci.h"
 #include "tt.h"
 
 namespace Nebula{
-  ThreadPool threads;
-  Thread::Thread(const size_t n) : idx(n), stdThread(&Thread::idleLoop,this){ waitForSearchFinished(); }
+  Thread::Thread(Engine& e, const size_t n) : idx(n), stdThread(&Thread::idleLoop,this), engine(e){ waitForSearchFinished(); }
 
   Thread::~Thread(){
     exit=true;
@@ -20,6 +22,16 @@ namespace Nebula{
     mainHistory.fill(0);
     captureHistory.fill(0);
     previousDepth=0;
+#ifdef USE_TT_VERIFY
+    ttStats={};
+#endif
+    accumulators.clear();
+    Eval::Nnue::clearCache(refreshTable);
+    evalCache.clear(engine.options["EvalCache"].asBool());
+#ifdef USE_SEARCH_STATS
+    stats={};
+    refreshTable.refreshes=refreshTable.updates=refreshTable.skipped=0;
+#endif
     for (const bool inCheck : {false,true})
       for (const StatsType c : {NoCaptures,Captures}){
         for (auto& to : continuationHistory[inCheck][c])
@@ -29,18 +41,42 @@ namespace Nebula{
       }
   }
 
+  void Thread::syncNetwork(){
+    if (networkGeneration==Eval::Nnue::networkGeneration)
+      return;
+    networkGeneration=Eval::Nnue::networkGeneration;
+    accumulators.clear();
+    Eval::Nnue::clearCache(refreshTable);
+    evalCache.clear(evalCache.enabled);
+  }
+
   void Thread::startSearching(){
     std::scoped_lock lk(mutex);
     searching=true;
     cv.notify_one();
   }
 
+  void Thread::runCustomJob(std::function<void()> f){
+    {
+      std::unique_lock lk(mutex);
+      cv.wait(lk,[&]{ return !searching; });
+      job=std::move(f);
+      searching=true;
+    }
+    cv.notify_one();
+  }
+
   void Thread::waitForSearchFinished(){
     std::unique_lock lk(mutex);
     cv.wait(lk,[&]{ return !searching; });
   }
 
   void Thread::idleLoop(){
+    Numa::bindThisThread(idx);
+#ifdef USE_TT_VERIFY
+    TranspositionTable::bindStats(&ttStats);
+#endif
+    nativeId=osThreadId();
     while (true){
       std::unique_lock lk(mutex);
       searching=false;
@@ -48,11 +84,28 @@ namespace Nebula{
       cv.wait(lk,[&]{ return searching; });
       if (exit)
         return;
+      const std::function<void()> f=std::move(job);
+      job=nullptr;
       lk.unlock();
-      search();
+      std::shared_lock network(Eval::Nnue::networkMutex);
+      syncNetwork();
+      if (f)
+        f();
+      else
+        search();
     }
   }
 
+  void MainThread::waitForStop(){
+    std::unique_lock lk(stopMutex);
+    stopCv.wait(lk,[&]{ return engine.threads.stop||!(ponder||engine.limits.infinite); });
+  }
+
+  void MainThread::wake(){
+    { std::scoped_lock lk(stopMutex); }
+    stopCv.notify_one();
+  }
+
   void ThreadPool::set(const size_t requested){
     if (size()>0){
       main()->waitForSearchFinished();
@@ -63,19 +116,21 @@ namespace Nebula{
     }
 
     if (requested>0){
-      push_back(new MainThread(0));
+      push_back(new MainThread(engine,0));
       while (size()<requested)
-        push_back(new Thread(static_cast<int>(size())));
+        push_back(new Thread(engine,size()));
 
       clear();
-      tt.resize(std::max<size_t>(1,options["Hash"].asSize()));
-      Search::init();
+      engine.tt.resize(std::max<size_t>(1,engine.options["Hash"].asSize()));
+      Search::init(*this);
     }
   }
 
   void ThreadPool::clear() const{
     for (Thread* th : *this)
-      th->clear();
+      th->runCustomJob([th]{ th->clear(); });
+    for (Thread* th : *this)
+      th->waitForSearchFinished();
     main()->callsCnt=0;
     main()->bestPreviousScore=VALUE_INFINITE;
     main()->bestPreviousAverageScore=VALUE_INFINITE;
@@ -85,10 +140,11 @@ namespace Nebula{
   void ThreadPool::startThinking(const Position& pos, StateListPtr& states,
     const Search::LimitsType& limits, const bool ponderMode){
     main()->waitForSearchFinished();
+    Uci::syncEvalFile(engine.options);
     main()->stopOnPonderhit=stop=false;
     increaseDepth=true;
     main()->ponder=ponderMode;
-    Search::limits=limits;
+    engine.limits=limits;
     Search::RootMoves rootMoves;
     for (const auto& m : MoveList<LEGAL>(pos))
       if (limits.searchmoves.empty()
@@ -97,7 +153,7 @@ namespace Nebula{
     if (states.get())
       setupStates=std::move(states);
     for (Thread* th : *this){
-      th->nodes=0;
+      th->nodes=th->ttProbes=th->ttHits=0;
       th->nmpMinPly=0;
       th->bestMoveChanges=0;
       th->rootDepth=th->completedDepth=0;
@@ -131,6 +187,43 @@ namespace Nebula{
     return bestThread;
   }
 
+#ifdef USE_TT_VERIFY
+  TtStats ThreadPool::ttStats() const{
+    TtStats sum{};
+    for (const Thread* th : *this){
+      sum.probes+=th->ttStats.probes;
+      sum.hits+=th->ttStats.hits;
+      sum.collisions+=th->ttStats.collisions;
+      sum.torn+=th->ttStats.torn;
+    }
+    return sum;
+  }
+#endif
+
+#ifdef USE_SEARCH_STATS
+  Search::Stats ThreadPool::searchStats() const{
+    Search::Stats sum{};
+    for (const Thread* th : *this){
+      const Search::Stats& st=th->stats;
+      sum.ttProbes+=st.ttProbes;
+      sum.ttHits+=st.ttHits;
+      sum.ttCutoffs+=st.ttCutoffs;
+      sum.nmpTries+=st.nmpTries;
+      sum.nmpCutoffs+=st.nmpCutoffs;
+      sum.probCutCutoffs+=st.probCutCutoffs;
+      sum.lmrResearches+=st.lmrResearches;
+      sum.futilityPrunes+=st.futilityPrunes;
+      sum.qsearchNodes+=st.qsearchNodes;
+      for (int i=0; i<MovePicker::stageCount; ++i)
+        sum.stages[i]+=st.stages[i];
+      sum.nnueRefreshes+=th->refreshTable.refreshes;
+      sum.nnueUpdates+=th->refreshTable.updates;
+      sum.nnueSkipped+=th->refreshTable.skipped;
+    }
+    return sum;
+  }
+#endif
+
   void ThreadPool::startSearching() const{
     for (Thread* th : *this)
       if (th!=front())
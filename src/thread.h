@@ -1,33 +1,52 @@
 #pragma once
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <vector>
+#include "evaluate.h"
 #include "movepick.h"
 #include "position.h"
 #include "search.h"
 #include "thread_win32_osx.h"
+#include "tt.h"
 
 namespace Nebula{
+  class Engine;
+
   class Thread{
     std::mutex mutex;
     std::condition_variable cv;
     size_t idx;
     bool exit=false, searching=true;
+    std::function<void()> job;
+    // Written by idleLoop before the constructor returns, so it must not be
+    // initialized after stdThread starts
+    int nativeId;
     NativeThread stdThread;
   public:
-    explicit Thread(size_t);
+    Thread(Engine& e, size_t n);
     virtual ~Thread();
+    static void* operator new(size_t size){ return alignedLargePagesAlloc(size); }
+    static void operator delete(void* mem){ alignedLargePagesFree(mem); }
     virtual void search();
     void clear();
+    // Drops accumulators and caches computed with an older network. Called
+    // with Eval::Nnue::networkMutex held.
+    void syncNetwork();
     void idleLoop();
     void startSearching();
+    void runCustomJob(std::function<void()> f);
     void waitForSearchFinished();
     size_t id() const{ return idx; }
+    int osId() const{ return nativeId; }
+    Engine& engine;
     size_t pvIdx, pvLast;
     RunningAverage complexityAverage;
     std::atomic<uint64_t> nodes, bestMoveChanges;
+    // TT probes of the current search and how many hit, for benchscale
+    std::atomic<uint64_t> ttProbes, ttHits;
     int nmpMinPly;
     Color nmpColor;
     Value bestValue, optimism[COLOR_NB];
@@ -41,12 +60,25 @@ namespace Nebula{
     CapturePieceToHistory captureHistory;
     ContinuationHistory continuationHistory[2][2];
     Score trend;
+#ifdef USE_TT_VERIFY
+    TtStats ttStats{};
+#endif
+#ifdef USE_SEARCH_STATS
+    Search::Stats stats{};
+#endif
+    Eval::Nnue::AccumulatorStack accumulators;
+    Eval::Nnue::AccumulatorCache refreshTable;
+    Eval::EvalCache evalCache;
+    uint32_t networkGeneration=0;
+    int reductions[maxMoves];
   };
 
   struct MainThread final : Thread{
     using Thread::Thread;
     void search() override;
     void checkTime();
+    void waitForStop();
+    void wake();
     double previousTimeReduction;
     Value bestPreviousScore;
     Value bestPreviousAverageScore;
@@ -54,19 +86,32 @@ namespace Nebula{
     int callsCnt;
     bool stopOnPonderhit;
     std::atomic_bool ponder;
+  private:
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
   };
 
   struct ThreadPool : std::vector<Thread*>{
+    explicit ThreadPool(Engine& e) : engine(e){}
     void startThinking(const Position&, StateListPtr&, const Search::LimitsType&, bool=false);
     void clear() const;
     void set(size_t);
     MainThread* main() const{ return dynamic_cast<MainThread*>(front()); }
     uint64_t nodesSearched() const{ return accumulate(&Thread::nodes); }
+    uint64_t ttProbes() const{ return accumulate(&Thread::ttProbes); }
+    uint64_t ttHits() const{ return accumulate(&Thread::ttHits); }
+#ifdef USE_TT_VERIFY
+    TtStats ttStats() const;
+#endif
+#ifdef USE_SEARCH_STATS
+    Search::Stats searchStats() const;
+#endif
     Thread* getBestThread() const;
     void startSearching() const;
     void waitForSearchFinished() const;
     std::atomic_bool stop, increaseDepth;
   private:
+    Engine& engine;
     StateListPtr setupStates;
 
     uint64_t accumulate(std::atomic<uint64_t> Thread::* member) const{
@@ -76,6 +121,4 @@ namespace Nebula{
       return sum;
     }
   };
-
-  extern ThreadPool threads;
 }
@@ -1,11 +1,13 @@
 #include <algorithm>
 #include <cmath>
+#include "engine.h"
 #include "search.h"
 #include "timeman.h"
-#include "uci.h"
 
 namespace Nebula{
-  TimeManagement time;
+  TimePoint TimeManagement::elapsed() const{
+    return engine.limits.npmsec?static_cast<TimePoint>(engine.threads.nodesSearched()):now()-startTime;
+  }
 
   void TimeManagement::init(Search::LimitsType& limits, const Color us, const int ply){
     constexpr TimePoint moveOverhead=10;
@@ -39,7 +41,7 @@ namespace Nebula{
     optimumTime=static_cast<TimePoint>(optScale*static_cast<double>(timeLeft));
     maximumTime=static_cast<TimePoint>(std::min(0.8*static_cast<double>(limits.time[us])-moveOverhead,
       maxScale*static_cast<double>(optimumTime)));
-    if (options["Ponder"].asBool())
+    if (engine.options["Ponder"].asBool())
       optimumTime+=optimumTime/4;
   }
 }
@@ -1,48 +1,277 @@
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
-#include <thread>
-#include <vector>
+#include <fstream>
+#include <iostream>
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define USE_MMAP
+#endif
 #include "misc.h"
+#include "numa.h"
 #include "thread.h"
 #include "tt.h"
-#include "uci.h"
 
 namespace Nebula{
-  TranspositionTable tt;
+  namespace{
+#ifdef USE_TT_VERIFY
+    thread_local TtStats* localStats=nullptr;
+#endif
 
+    constexpr char dumpMagic[8]={'N','E','B','T','T','D','M','P'};
+    constexpr size_t dumpOffset=4096;
+    // Bumped whenever the entry layout changes. 2: clear epoch in genBound8.
+    constexpr uint16_t dumpVersion=2;
+#ifdef USE_TT_VERIFY
+    constexpr uint8_t dumpVerify=1;
+#else
+    constexpr uint8_t dumpVerify=0;
+#endif
+    constexpr TtData noData{MOVE_NONE,VALUE_NONE,VALUE_NONE,DEPTH_OFFSET,BOUND_NONE,false};
+
+    struct DumpHeader{
+      char magic[8];
+      uint64_t clusterCount;
+      uint32_t clusterSize;
+      uint8_t generation8;
+      uint8_t entriesPerCluster, verify;
+      uint16_t version;
+    };
+  }
+
+#ifdef USE_TT_VERIFY
+  void TranspositionTable::bindStats(TtStats* s){ localStats=s; }
+
+  void TtEntry::save(const uint64_t k, const Value v, const bool pv, const Bound b,
+    const Depth d, const Move m, const Value ev, const uint8_t generation8){
+    const uint64_t old=data;
+    const bool sameKey=(keyXor^old)==k;
+    const uint16_t m16=m||!sameKey
+                         ?static_cast<uint16_t>(m)
+                         :static_cast<uint16_t>(old);
+    uint64_t next;
+
+    if (b==BOUND_EXACT
+      ||!sameKey
+      ||d-DEPTH_OFFSET+2*pv>depth8(old)-4)
+      next=pack(m16,static_cast<int16_t>(v),static_cast<int16_t>(ev),static_cast<uint8_t>(d-DEPTH_OFFSET),
+        static_cast<uint8_t>(generation8|static_cast<uint8_t>(pv)<<2|b));
+    else
+      next=(old&~0xFFFFULL)|m16;
+
+    if (next!=old){
+      data=next;
+      keyXor=k^next;
+    }
+  }
+#else
   void TtEntry::save(const uint64_t k, const Value v, const bool pv, const Bound b,
-    const Depth d, const Move m, const Value ev){
-    if (m||static_cast<uint16_t>(k)!=key16)
+    const Depth d, const Move m, const Value ev, const uint8_t generation8){
+    const bool otherKey=static_cast<uint16_t>(k)!=key16;
+    if (m||otherKey)
       move16=static_cast<uint16_t>(m);
 
     if (b==BOUND_EXACT
-      ||static_cast<uint16_t>(k)!=key16
+      ||otherKey
       ||d-DEPTH_OFFSET+2*pv>depth8-4){
       key16=static_cast<uint16_t>(k);
       depth8=static_cast<uint8_t>(d-DEPTH_OFFSET);
-      genBound8=static_cast<uint8_t>(tt.generation8|static_cast<uint8_t>(pv)<<2|b);
+      genBound8=static_cast<uint8_t>(generation8|static_cast<uint8_t>(pv)<<2|b);
       value16=static_cast<int16_t>(v);
       eval16=static_cast<int16_t>(ev);
     }
   }
+#endif
 
   void TranspositionTable::resize(const size_t mbSize){
     threads.main()->waitForSearchFinished();
 
-    stdAlignedFree(table);
+    const size_t newClusterCount=mbSize*1024*1024/sizeof(Cluster);
+    const size_t bytes=newClusterCount*sizeof(Cluster);
 
-    clusterCount=mbSize*1024*1024/sizeof(Cluster);
-    table=static_cast<Cluster*>(
-      stdAlignedAlloc(alignof(Cluster),clusterCount*sizeof(Cluster)));
+    if (!table||mappedSize||bytes>allocatedSize){
+      release();
+      table=static_cast<Cluster*>(alignedLargePagesAlloc(bytes,&pages));
+      if (!table){
+        std::cerr<<"Failed to allocate "<<mbSize<<"MB for transposition table."<<std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      allocatedSize=bytes;
+      Numa::interleave(table,bytes);
+    }
+    else if (newClusterCount<clusterCount)
+      discardLargePages(&table[newClusterCount],(clusterCount-newClusterCount)*sizeof(Cluster));
 
+    clusterCount=newClusterCount;
     clear();
   }
 
-  void TranspositionTable::clear() const{
-    const size_t threadsCount=std::max<size_t>(1,options["Threads"].asSize());
+  // A reused table keeps the placement it was allocated with, so a change of
+  // NumaPolicy moves the pages it already has.
+  void TranspositionTable::applyNumaPolicy(){
+    threads.main()->waitForSearchFinished();
+    if (table&&!mappedSize)
+      Numa::interleave(table,allocatedSize,true);
+  }
+
+  void TranspositionTable::release(){
+#ifdef USE_MMAP
+    if (mappedSize){
+      munmap(table,mappedSize);
+      mappedSize=0;
+      table=nullptr;
+      return;
+    }
+#endif
+    alignedLargePagesFree(table);
+    table=nullptr;
+    allocatedSize=0;
+  }
+
+  bool TranspositionTable::save(const std::string& file){
+    threads.main()->waitForSearchFinished();
+    finishClear();
+    std::ofstream out(file,std::ios::binary);
+    if (!out)
+      return false;
+
+    DumpHeader h{};
+    std::memcpy(h.magic,dumpMagic,sizeof(dumpMagic));
+    h.clusterCount=clusterCount;
+    h.clusterSize=sizeof(Cluster);
+    h.generation8=generation();
+    h.entriesPerCluster=ClusterSize;
+    h.verify=dumpVerify;
+    h.version=dumpVersion;
+    std::string head(dumpOffset,'\0');
+    std::memcpy(head.data(),&h,sizeof(h));
+    out.write(head.data(),dumpOffset);
+    out.write(reinterpret_cast<const char*>(table),static_cast<std::streamsize>(clusterCount*sizeof(Cluster)));
+    return static_cast<bool>(out);
+  }
+
+  bool TranspositionTable::load(const std::string& file){
+    threads.main()->waitForSearchFinished();
+    std::ifstream in(file,std::ios::binary|std::ios::ate);
+    if (!in)
+      return false;
 
-    std::vector<std::thread> thrds;
-    thrds.reserve(threadsCount);
+    const auto fileSize=static_cast<size_t>(in.tellg());
+    const size_t bytes=clusterCount*sizeof(Cluster);
+    DumpHeader h{};
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(&h),sizeof(h));
+    if (!in
+      ||std::memcmp(h.magic,dumpMagic,sizeof(dumpMagic))
+      ||h.clusterSize!=sizeof(Cluster)
+      ||h.entriesPerCluster!=ClusterSize
+      ||h.verify!=dumpVerify
+      ||h.version!=dumpVersion
+      ||h.clusterCount!=clusterCount
+      ||h.generation8&(GENERATION_DELTA-1)&~EPOCH_BIT
+      ||fileSize<dumpOffset+bytes)
+      return false;
 
+#ifdef USE_MMAP
+    // Map the dump copy-on-write, pages are faulted in from the page cache
+    // as the search touches them.
+    const int fd=open(file.c_str(),O_RDONLY);
+    if (fd==-1)
+      return false;
+    void* mem=mmap(nullptr,bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,dumpOffset);
+    close(fd);
+    if (mem==MAP_FAILED)
+      return false;
+    release();
+    table=static_cast<Cluster*>(mem);
+    mappedSize=bytes;
+    pages=PageMode::Default;
+#else
+    in.seekg(dumpOffset);
+    in.read(reinterpret_cast<char*>(table),static_cast<std::streamsize>(bytes));
+    if (!in){
+      clear();
+      return false;
+    }
+#endif
+    clearing=false;
+    generation8=h.generation8&GENERATION_MASK;
+    epoch8=h.generation8&EPOCH_BIT;
+    return true;
+  }
+
+  // A background clear is swept a slice per search, so it is done before
+  // the next one flips the epoch back.
+  void TranspositionTable::newSearch(){
+    generation8+=GENERATION_DELTA;
+    if (clearing){
+      const size_t end=std::min(clusterCount,sweepCursor+clusterCount/sweepSlices+1);
+      sweep(sweepCursor,end);
+      sweepCursor=end;
+      clearing=end<clusterCount;
+    }
+  }
+
+  // Permille of a sample of entries that were written by the current search.
+  int TranspositionTable::hashfull() const{
+    const size_t n=std::min<size_t>(1000,clusterCount);
+    size_t cnt=0;
+    for (size_t i=0; i<n; ++i)
+      for (const TtEntry& e : table[i].entry)
+        cnt+=e.depth()!=DEPTH_OFFSET&&(e.genBound()&GENERATION_MASK)==generation8;
+    return n?static_cast<int>(cnt*1000/(n*ClusterSize)):0;
+  }
+
+  // Zeroes the stale entries of clusters [begin, end) on the pool threads.
+  // The calling thread takes the first slice, so the main thread can run it
+  // from newSearch before the helpers start.
+  void TranspositionTable::sweep(const size_t begin, const size_t end){
+    const auto work=[this](const size_t first, const size_t last){
+      for (size_t i=first; i<last; ++i)
+        for (TtEntry& e : table[i].entry)
+          if (e.depth()!=DEPTH_OFFSET&&stale(e.genBound()))
+            e=TtEntry{};
+    };
+    const size_t n=std::max<size_t>(1,threads.size());
+    const size_t stride=(end-begin)/n;
+    for (size_t idx=1; idx<n; ++idx){
+      const size_t first=begin+stride*idx;
+      const size_t last=idx+1<n?first+stride:end;
+      threads[idx]->runCustomJob([work, first, last]{ work(first,last); });
+    }
+    work(begin,n>1?begin+stride:end);
+    for (size_t idx=1; idx<n; ++idx)
+      threads[idx]->waitForSearchFinished();
+  }
+
+  void TranspositionTable::finishClear(){
+    if (clearing)
+      sweep(sweepCursor,clusterCount);
+    clearing=false;
+  }
+
+  // In the background only the generation and the epoch move on. The
+  // entries written before are stale from then on and the searches sweep
+  // them in slices.
+  void TranspositionTable::clear(const bool background){
+    if (background){
+      finishClear();
+      generation8+=GENERATION_DELTA;
+      epoch8^=EPOCH_BIT;
+      sweepCursor=0;
+      clearing=true;
+      return;
+    }
+
+    clearing=false;
+    if (threads.empty()){
+      std::memset(table,0,clusterCount*sizeof(Cluster));
+      return;
+    }
+
+    const size_t threadsCount=threads.size();
     const size_t stride=clusterCount/threadsCount;
 
     for (size_t idx=0; idx<threadsCount; ++idx){
@@ -51,32 +280,97 @@ namespace Nebula{
                        ?stride
                        :clusterCount-start;
 
-      thrds.emplace_back([this, start, len]{ std::memset(&table[start],0,len*sizeof(Cluster)); });
+      threads[idx]->runCustomJob([this, start, len]{ std::memset(&table[start],0,len*sizeof(Cluster)); });
     }
 
-    for (std::thread& th : thrds)
-      th.join();
+    for (Thread* th : threads)
+      th->waitForSearchFinished();
   }
 
-  TtEntry* TranspositionTable::probe(const uint64_t key, bool& found) const{
+#ifdef USE_TT_VERIFY
+  TtEntry* TranspositionTable::probe(const uint64_t key, bool& found, TtData& data) const{
+    const size_t index=mulHi64(key,clusterCount);
+    TtEntry* const tte=&table[index].entry[0];
+
+    if (TtStats* const st=localStats){
+      ++st->probes;
+      for (int i=0; i<ClusterSize; ++i){
+        const uint64_t d=tte[i].data;
+        const uint64_t k=tte[i].keyXor^d;
+        if (k==key||!TtEntry::depth8(d))
+          continue;
+        // A stored key that does not hash to this cluster can only come from
+        // halves of two different writes.
+        if (mulHi64(k,clusterCount)!=index)
+          ++st->torn;
+        else if (static_cast<uint16_t>(k)==static_cast<uint16_t>(key))
+          ++st->collisions;
+      }
+    }
+
+    for (int i=0; i<ClusterSize; ++i){
+      const uint64_t d=tte[i].data;
+      const uint64_t k=tte[i].keyXor^d;
+      if (k==key||!TtEntry::depth8(d)||stale(TtEntry::genBound8(d))){
+        if (stale(TtEntry::genBound8(d))){
+          tte[i]=TtEntry{};
+          found=false;
+          data=noData;
+          return &tte[i];
+        }
+        const uint64_t next=(d&~(0xFFULL<<56))
+          |static_cast<uint64_t>(generation()|(TtEntry::genBound8(d)&(EPOCH_BIT-1)))<<56;
+        if (next!=d){
+          tte[i].data=next;
+          tte[i].keyXor=k^next;
+        }
+        found=static_cast<bool>(TtEntry::depth8(d));
+        data=found?TtEntry::unpack(d):noData;
+        if (found&&localStats)
+          ++localStats->hits;
+        return &tte[i];
+      }
+    }
+
+    TtEntry* replace=tte;
+    for (int i=1; i<ClusterSize; ++i)
+      if (TtEntry::depth8(replace->data)-relativeAge(TtEntry::genBound8(replace->data))
+        >TtEntry::depth8(tte[i].data)-relativeAge(TtEntry::genBound8(tte[i].data)))
+        replace=&tte[i];
+
+    found=false;
+    data=noData;
+    return replace;
+  }
+#else
+  TtEntry* TranspositionTable::probe(const uint64_t key, bool& found, TtData& data) const{
     TtEntry* const tte=firstEntry(key);
     const auto key16=static_cast<uint16_t>(key);
 
     for (int i=0; i<ClusterSize; ++i)
-      if (tte[i].key16==key16||!tte[i].depth8){
+      if (tte[i].key16==key16||!tte[i].depth8||stale(tte[i].genBound8)){
+        if (stale(tte[i].genBound8)){
+          tte[i]=TtEntry{};
+          found=false;
+          data=noData;
+          return &tte[i];
+        }
         tte[i].genBound8=static_cast<uint8_t>(
-          generation8|(tte[i].genBound8&(GENERATION_DELTA-1)));
+          generation()|(tte[i].genBound8&(EPOCH_BIT-1)));
         found=static_cast<bool>(tte[i].depth8);
+        data=found?tte[i].read():noData;
         return &tte[i];
       }
 
     TtEntry* replace=tte;
     for (int i=1; i<ClusterSize; ++i)
-      if (replace->depth8-((GENERATION_CYCLE+generation8-replace->genBound8)&GENERATION_MASK)
-        >tte[i].depth8-((GENERATION_CYCLE+generation8-tte[i].genBound8)&GENERATION_MASK))
+      if (replace->depth8-relativeAge(replace->genBound8)
+        >tte[i].depth8-relativeAge(tte[i].genBound8))
         replace=&tte[i];
 
     found=false;
+    data=noData;
     return replace;
   }
+#endif
 }
@@ -1,8 +1,55 @@
 #pragma once
+#include <string>
 #include "misc.h"
 #include "types.h"
 
 namespace Nebula{
+  struct ThreadPool;
+
+  struct TtStats{
+    uint64_t probes, hits, collisions, torn;
+  };
+
+  // What a probe found, copied out of the entry. Other threads may rewrite
+  // the entry while the search still uses these.
+  struct TtData{
+    Move move;
+    Value value, eval;
+    Depth depth;
+    Bound bound;
+    bool isPv;
+  };
+
+#ifdef USE_TT_VERIFY
+  // The key is stored xor-ed with the packed data word, so an entry whose two
+  // halves come from different writes no longer matches any key.
+  struct TtEntry{
+    [[nodiscard]] Move move() const{ return static_cast<Move>(static_cast<uint16_t>(data)); }
+    [[nodiscard]] Value value() const{ return static_cast<Value>(static_cast<int16_t>(data>>16)); }
+    [[nodiscard]] Value eval() const{ return static_cast<Value>(static_cast<int16_t>(data>>32)); }
+    [[nodiscard]] Depth depth() const{ return static_cast<Depth>(depth8(data))+DEPTH_OFFSET; }
+    [[nodiscard]] bool isPv() const{ return static_cast<bool>(genBound8(data)&0x4); }
+    [[nodiscard]] Bound bound() const{ return static_cast<Bound>(genBound8(data)&0x3); }
+    void save(uint64_t k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8);
+  private:
+    friend class TranspositionTable;
+    [[nodiscard]] uint8_t genBound() const{ return genBound8(data); }
+    static TtData unpack(const uint64_t d){
+      return {static_cast<Move>(static_cast<uint16_t>(d)),static_cast<Value>(static_cast<int16_t>(d>>16)),
+        static_cast<Value>(static_cast<int16_t>(d>>32)),static_cast<Depth>(depth8(d))+DEPTH_OFFSET,
+        static_cast<Bound>(genBound8(d)&0x3),static_cast<bool>(genBound8(d)&0x4)};
+    }
+    static uint8_t depth8(const uint64_t d){ return static_cast<uint8_t>(d>>48); }
+    static uint8_t genBound8(const uint64_t d){ return static_cast<uint8_t>(d>>56); }
+    static uint64_t pack(const uint16_t m, const int16_t v, const int16_t ev, const uint8_t d8, const uint8_t gb8){
+      return static_cast<uint64_t>(m)|static_cast<uint64_t>(static_cast<uint16_t>(v))<<16
+        |static_cast<uint64_t>(static_cast<uint16_t>(ev))<<32|static_cast<uint64_t>(d8)<<48
+        |static_cast<uint64_t>(gb8)<<56;
+    }
+    uint64_t keyXor;
+    uint64_t data;
+  };
+#else
   struct TtEntry{
     [[nodiscard]] Move move() const{ return static_cast<Move>(move16); }
     [[nodiscard]] Value value() const{ return static_cast<Value>(value16); }
@@ -10,9 +57,11 @@ namespace Nebula{
     [[nodiscard]] Depth depth() const{ return static_cast<Depth>(depth8)+DEPTH_OFFSET; }
     [[nodiscard]] bool isPv() const{ return static_cast<bool>(genBound8&0x4); }
     [[nodiscard]] Bound bound() const{ return static_cast<Bound>(genBound8&0x3); }
-    void save(uint64_t k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
+    void save(uint64_t k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8);
   private:
     friend class TranspositionTable;
+    [[nodiscard]] uint8_t genBound() const{ return genBound8; }
+    [[nodiscard]] TtData read() const{ return {move(),value(),eval(),depth(),bound(),isPv()}; }
     uint16_t key16;
     uint8_t depth8;
     uint8_t genBound8;
@@ -21,31 +70,75 @@ namespace Nebula{
     int16_t eval16;
   };
 
+#endif
+
   class TranspositionTable{
+#ifdef USE_TT_VERIFY
+    static constexpr int ClusterSize=2;
+
+    struct Cluster{
+      TtEntry entry[ClusterSize];
+    };
+#else
     static constexpr int ClusterSize=3;
 
     struct Cluster{
       TtEntry entry[ClusterSize];
       char padding[2];
     };
+#endif
+    static_assert(sizeof(Cluster)==32,"Unexpected Cluster size");
 
-    static constexpr unsigned GENERATION_BITS=3;
+    // genBound8 holds the bound in bits 0-1, pv in bit 2, the clear epoch in
+    // bit 3 and the generation above
+    static constexpr unsigned GENERATION_BITS=4;
     static constexpr int GENERATION_DELTA=1<<GENERATION_BITS;
     static constexpr int GENERATION_CYCLE=255+(1<<GENERATION_BITS);
     static constexpr int GENERATION_MASK=0xFF<<GENERATION_BITS&0xFF;
+    static constexpr uint8_t EPOCH_BIT=0x8;
   public:
-    ~TranspositionTable(){ alignedLargePagesFree(table); }
-    void newSearch(){ generation8+=GENERATION_DELTA; }
-    TtEntry* probe(uint64_t key, bool& found) const;
+    explicit TranspositionTable(ThreadPool& pool) : threads(pool){}
+    ~TranspositionTable(){ release(); }
+    void newSearch();
+    // Returns the entry to save to. Only data, filled in when found, tells
+    // what was stored for the key.
+    TtEntry* probe(uint64_t key, bool& found, TtData& data) const;
     void resize(size_t mbSize);
-    void clear() const;
+    void applyNumaPolicy();
+    void clear(bool background=false);
+    void finishClear();
+    bool save(const std::string& file);
+    bool load(const std::string& file);
     [[nodiscard]] TtEntry* firstEntry(const uint64_t key) const{ return &table[mulHi64(key,clusterCount)].entry[0]; }
+    [[nodiscard]] PageMode pageMode() const{ return pages; }
+    [[nodiscard]] uint8_t generation() const{ return generation8|epoch8; }
+    [[nodiscard]] int hashfull() const;
+#ifdef USE_TT_VERIFY
+    static void bindStats(TtStats* s);
+#endif
   private:
-    friend struct TtEntry;
-    size_t clusterCount;
-    Cluster* table;
-    uint8_t generation8;
+    static constexpr size_t sweepSlices=16;
+    void release();
+    void sweep(size_t begin, size_t end);
+    // A background clear flips the epoch. Until it is swept, entries of the
+    // other epoch are stale however many searches ago they were written. A
+    // probe takes such an entry like an empty one and resets it before the
+    // search sees it.
+    [[nodiscard]] bool stale(const uint8_t genBound8) const{ return clearing&&(genBound8&EPOCH_BIT)!=epoch8; }
+    // Searches since genBound8 was written, weighted 8 plies each against
+    // the depth of the entry
+    [[nodiscard]] int relativeAge(const uint8_t genBound8) const{
+      return ((GENERATION_CYCLE+generation8-genBound8)&GENERATION_MASK)>>1;
+    }
+    ThreadPool& threads;
+    size_t clusterCount=0;
+    Cluster* table=nullptr;
+    size_t allocatedSize=0;
+    size_t mappedSize=0;
+    uint8_t generation8=0;
+    uint8_t epoch8=0;
+    bool clearing=false;
+    size_t sweepCursor=0;
+    PageMode pages=PageMode::Default;
   };
-
-  extern TranspositionTable tt;
 }
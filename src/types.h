@@ -29,6 +29,15 @@
 #ifdef USE_PEXT
 #include <immintrin.h>
 #define pext(b, m) _pext_u64(b, m)
+#elif defined(USE_FAT)
+// Fat builds decide at startup whether to use pext. The instruction is
+// emitted directly so the callers can stay on the baseline instruction set.
+inline uint64_t pextBmi2(const uint64_t b, const uint64_t m){
+  uint64_t r;
+  asm("pextq %2, %1, %0" : "=r"(r) : "r"(b), "rm"(m));
+  return r;
+}
+#define pext(b, m) pextBmi2(b, m)
 #else
 #define pext(b, m) 0
 #endif
@@ -45,6 +54,8 @@ namespace Nebula {
 
 #ifdef USE_PEXT
   constexpr bool hasPext=true;
+#elif defined(USE_FAT)
+  extern const bool hasPext;
 #else
   constexpr bool hasPext=false;
 #endif
@@ -1,22 +1,29 @@
 #include <algorithm>
+#include <array>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include "movegen.h"
 #include "bench.h"
+#include "engine.h"
+#include "evaluate.h"
+#include "numa.h"
 #include "position.h"
 #include "search.h"
-#include "thread.h"
 #include "uci.h"
 using namespace std;
 
 namespace Nebula{
-  extern vector<string> setupBench();
-
   namespace{
     auto startFen="rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
-    void position(Position& pos, istringstream& is, StateListPtr& states){
+    void position(Engine& engine, Position& pos, istringstream& is, StateListPtr& states){
       Move m;
       string token, fen;
       is>>token;
@@ -30,25 +37,25 @@ namespace Nebula{
       else
         return;
       states=std::make_unique<std::deque<StateInfo>>(1);
-      pos.set(fen,false,&states->back(),threads.main());
+      pos.set(fen,false,&states->back(),engine.threads.main());
       while (is>>token&&(m=Uci::toMove(pos,token))!=MOVE_NONE){
         states->emplace_back();
         pos.doMove(m,states->back());
       }
     }
 
-    void setoption(istringstream& is){
+    void setoption(Engine& engine, istringstream& is){
       string token, name, value;
       is>>token;
       while (is>>token&&token!="value")
         name+=(name.empty()?"":" ")+token;
       while (is>>token)
         value+=(value.empty()?"":" ")+token;
-      if (options.contains(name))
-        options[name]=value;
+      if (engine.options.contains(name))
+        engine.options[name]=value;
     }
 
-    void go(const Position& pos, istringstream& is, StateListPtr& states){
+    void go(Engine& engine, const Position& pos, istringstream& is, StateListPtr& states){
       Search::LimitsType limits;
       string token;
       bool ponderMode=false;
@@ -68,41 +75,759 @@ namespace Nebula{
         else if (token=="mate") is>>limits.mate;
         else if (token=="infinite") limits.infinite=1;
         else if (token=="ponder") ponderMode=true;
-      threads.startThinking(pos,states,limits,ponderMode);
+      engine.threads.startThinking(pos,states,limits,ponderMode);
     }
 
-    void bench(const Position& pos, StateListPtr& states){
-      string token;
-      uint64_t nodes=0, cnt=1;
-      vector<string> list=setupBench();
+    using PerfCounts = std::array<uint64_t, PerfCounters::EventNb>;
+
+    volatile uint64_t phaseSink;
+
+    struct Phase{
+      const char* name;
+      uint64_t calls;
+      double ns, perf[PerfCounters::EventNb];
+    };
+
+    // Movegen, NNUE and TT work on the bench positions, each measured alone
+    // on this thread: switching counters between phases inside the search
+    // would cost a system call per switch. The update phase is doMove, the
+    // incremental accumulator update and undoMove for every legal move. The
+    // positions share the accumulator stack of the thread, so the NNUE phases
+    // run position by position. TT probes use random keys, so they miss the
+    // caches like the search does.
+    vector<Phase> benchPhases(Engine& engine, const vector<string>& fens){
+      MainThread* main=engine.threads.main();
+      const size_t n=fens.size();
+      vector<Position> positions(n);
+      vector<StateInfo> states(n);
+      vector<vector<Move>> moves(n);
+      for (size_t i=0; i<n; ++i){
+        positions[i].set(fens[i],false,&states[i],main);
+        for (const Move m : MoveList<LEGAL>(positions[i]))
+          moves[i].push_back(m);
+        Eval::Nnue::evaluate(positions[i]);
+      }
+      Prng rng(1070372);
+      vector<uint64_t> keys(1<<20);
+      for (uint64_t& key : keys)
+        key=rng.rand<uint64_t>();
+      const PerfCounters counters;
+      vector<Phase> phases;
+      uint64_t sink=0;
+      const auto measure=[&](const char* name, const int repeats, const auto& work){
+        PerfCounts perf{};
+        uint64_t calls=0;
+        const auto start=PerftClock::now();
+        counters.start();
+        for (int r=0; r<repeats; ++r)
+          calls+=work();
+        counters.stop(perf.data());
+        Phase p{name,calls,double(perftNanoseconds(start,PerftClock::now()))/calls,{}};
+        for (int e=0; e<PerfCounters::EventNb; ++e)
+          p.perf[e]=double(perf[e])/calls;
+        phases.push_back(p);
+      };
+      measure("movegen",2000,[&]{
+        for (const Position& pos : positions)
+          sink+=MoveList<LEGAL>(pos).size();
+        return n;
+      });
+      measure("nnue propagate",1,[&]{
+        for (const Position& pos : positions)
+          for (int r=0; r<2000; ++r)
+            sink+=Eval::Nnue::evaluate(pos);
+        return n*2000;
+      });
+      measure("nnue update",1,[&]{
+        StateInfo st;
+        uint64_t calls=0;
+        for (size_t i=0; i<n; ++i){
+          Eval::Nnue::updateAccumulators(positions[i]);
+          for (int r=0; r<20; ++r)
+            for (const Move m : moves[i]){
+              positions[i].doMove(m,st);
+              Eval::Nnue::updateAccumulators(positions[i]);
+              positions[i].undoMove(m);
+              ++calls;
+            }
+        }
+        return calls;
+      });
+      measure("tt probe",1,[&]{
+        bool found;
+        TtData data;
+        for (const uint64_t key : keys){
+          engine.tt.probe(key,found,data);
+          sink+=data.depth;
+        }
+        return keys.size();
+      });
+      phaseSink=sink;
+      return phases;
+    }
+
+    // With json or csv after the bench arguments the search output and the
+    // option reports are silenced and a report with one record per position
+    // is printed instead. Options the bench list sets are restored after it.
+    // The total node count doubles as the bench signature. Hardware counters
+    // are read around every search, summed over the pool threads, and a
+    // breakdown by phase follows the positions.
+    void bench(Engine& engine, Position& pos, istringstream& args, StateListPtr& states){
+      struct Result{
+        string fen;
+        uint64_t nodes;
+        TimePoint time;
+        Depth depth;
+        int hashfull;
+        PerfCounts perf;
+      };
+      string token, format="text";
+      const vector<string> list=setupBench(pos,args);
+      args>>format;
+      const bool quiet=format=="json"||format=="csv";
+      const auto onPv=engine.onPv;
+      const auto onBestMove=engine.onBestMove;
+      const auto onMessage=engine.onMessage;
+      std::map<string, string> options;
+      Uci::syncEvalFile(engine.options);
+      for (const auto& [name, o] : engine.options)
+        options[name]=o.asString();
+      if (quiet){
+        engine.onPv=[](const Position&, Depth){};
+        engine.onBestMove=[](const Position&, Move, Move){};
+        engine.onMessage=[](const string&){};
+      }
+      vector<Result> results;
+      vector<string> fens;
+      uint64_t nodes=0;
+      PerfCounts perf{};
+      bool perfAvailable=false;
       const uint64_t num=ranges::count_if(list,[](const string& s){ return s.starts_with("go "); });
       TimePoint elapsed=now();
       for (const auto& cmd : list){
         istringstream is(cmd);
         is>>skipws>>token;
         if (token=="go"){
-          cout<<"\nPosition: "<<cnt++<<'/'<<num<<endl;
-          if (token=="go"){
-            go(pos,is,states);
-            threads.main()->waitForSearchFinished();
-            nodes+=threads.nodesSearched();
-          }
+          if (!quiet)
+            cout<<"\nPosition: "<<results.size()+1<<'/'<<num<<endl;
+          vector<std::unique_ptr<PerfCounters>> counters;
+          for (const Thread* th : engine.threads)
+            counters.emplace_back(std::make_unique<PerfCounters>(th->osId()));
+          perfAvailable=counters.front()->available();
+          PerfCounts positionPerf{};
+          const TimePoint start=now();
+          for (const auto& c : counters)
+            c->start();
+          go(engine,pos,is,states);
+          engine.threads.main()->waitForSearchFinished();
+          for (const auto& c : counters)
+            c->stop(positionPerf.data());
+          results.push_back({pos.fen(),engine.threads.nodesSearched(),now()-start+1,
+            engine.threads.main()->completedDepth,engine.tt.hashfull(),positionPerf});
+          fens.push_back(pos.fen());
+          nodes+=results.back().nodes;
+          for (int e=0; e<PerfCounters::EventNb; ++e)
+            perf[e]+=positionPerf[e];
+        }
+        else if (token=="position") position(engine,pos,is,states);
+        else if (token=="setoption") setoption(engine,is);
+        else if (token=="ucinewgame") Search::clear(engine);
+      }
+      elapsed=now()-elapsed+1;
+      uint64_t evalProbes=0, evalHits=0;
+      for (const Thread* th : engine.threads){
+        evalProbes+=th->evalCache.probes;
+        evalHits+=th->evalCache.hits;
+      }
+      const vector<Phase> phases=fens.empty()?vector<Phase>():benchPhases(engine,fens);
+      const size_t threadCount=engine.threads.size(), hashMb=engine.options["Hash"].asSize();
+      engine.onMessage=[](const string&){};
+      for (auto& [name, o] : engine.options)
+        if (o.asString()!=options[name])
+          o=options[name];
+      engine.onPv=onPv;
+      engine.onBestMove=onBestMove;
+      engine.onMessage=onMessage;
+      const auto perfJson=[&](const auto& counts){
+        ostringstream ss;
+        if (perfAvailable)
+          for (int e=0; e<PerfCounters::EventNb; ++e)
+            ss<<",\""<<PerfCounters::name(PerfCounters::Event(e))<<"\":"<<counts[e];
+        return ss.str();
+      };
+      const auto perfCsv=[&](const auto& counts){
+        ostringstream ss;
+        for (int e=0; e<PerfCounters::EventNb; ++e){
+          ss<<',';
+          if (perfAvailable)
+            ss<<counts[e];
+        }
+        return ss.str();
+      };
+      if (format=="json"){
+        cout<<"{\"threads\":"<<threadCount<<",\"hash\":"<<hashMb<<",\"positions\":[";
+        for (size_t i=0; i<results.size(); ++i){
+          const Result& r=results[i];
+          cout<<(i?",":"")<<"{\"fen\":\""<<r.fen<<"\",\"nodes\":"<<r.nodes<<",\"time\":"<<r.time
+            <<",\"nps\":"<<1000*r.nodes/r.time<<",\"depth\":"<<r.depth<<",\"hashfull\":"<<r.hashfull
+            <<perfJson(r.perf)<<"}";
+        }
+        cout<<"],\"phases\":[";
+        for (size_t i=0; i<phases.size(); ++i)
+          cout<<(i?",":"")<<"{\"name\":\""<<phases[i].name<<"\",\"calls\":"<<phases[i].calls
+            <<",\"ns\":"<<phases[i].ns<<perfJson(phases[i].perf)<<"}";
+        cout<<"],\"nodes\":"<<nodes<<",\"time\":"<<elapsed<<",\"nps\":"<<1000*nodes/elapsed
+          <<perfJson(perf)<<",\"evalCacheProbes\":"<<evalProbes<<",\"evalCacheHits\":"<<evalHits
+          <<",\"signature\":"<<nodes<<"}"<<endl;
+      }
+      else if (format=="csv"){
+        string perfHeader;
+        for (int e=0; e<PerfCounters::EventNb; ++e)
+          perfHeader+=string(",")+PerfCounters::name(PerfCounters::Event(e));
+        cout<<"position,fen,nodes,time,nps,depth,hashfull"<<perfHeader<<'\n';
+        for (size_t i=0; i<results.size(); ++i){
+          const Result& r=results[i];
+          cout<<i+1<<','<<r.fen<<','<<r.nodes<<','<<r.time<<','<<1000*r.nodes/r.time<<','<<r.depth<<','<<r.hashfull
+            <<perfCsv(r.perf)<<'\n';
+        }
+        cout<<"total,,"<<nodes<<','<<elapsed<<','<<1000*nodes/elapsed<<",,"<<perfCsv(perf)<<"\n\n";
+        cout<<"phase,calls,ns"<<perfHeader<<'\n';
+        for (const Phase& p : phases)
+          cout<<p.name<<','<<p.calls<<','<<p.ns<<perfCsv(p.perf)<<'\n';
+        cout<<std::flush;
+      }
+      else{
+        cout<<"\nTime (ms) : "<<elapsed
+          <<"\nNodes     : "<<nodes
+          <<"\nNPS       : "<<1000*nodes/elapsed
+          <<"\nEval cache: "<<evalHits<<" hits of "<<evalProbes<<" probes"<<endl;
+        if (perfAvailable){
+          cout<<"IPC       : "<<double(perf[PerfCounters::Instructions])/std::max<uint64_t>(1,perf[PerfCounters::Cycles]);
+          for (int e=0; e<PerfCounters::EventNb; ++e)
+            cout<<"\n"<<PerfCounters::name(PerfCounters::Event(e))<<" per node: "<<double(perf[e])/std::max<uint64_t>(1,nodes);
+          cout<<endl;
         }
+        for (const Phase& p : phases){
+          cout<<"\n"<<p.name<<": "<<p.calls<<" calls, "<<p.ns<<" ns";
+          if (perfAvailable)
+            for (int e=0; e<PerfCounters::EventNb; ++e)
+              cout<<", "<<p.perf[e]<<" "<<PerfCounters::name(PerfCounters::Event(e));
+        }
+        cout<<(phases.empty()?"":"\n")<<(perfAvailable?"":"Hardware counters unavailable\n")<<std::flush;
+      }
+    }
+
+    void numaBench(Engine& engine, Position& pos, istringstream& is, StateListPtr& states){
+      TimePoint movetime=500;
+      is>>movetime;
+      const NumaPolicy policy=Numa::policy();
+      if (policy==NumaPolicy::None)
+        Numa::setPolicy(NumaPolicy::Bind);
+      for (size_t n=1; n<=Numa::nodeCount(); ++n){
+        size_t threadCount=0;
+        for (size_t k=0; k<n; ++k)
+          threadCount+=Numa::cpusOnNode(k);
+        Numa::setActiveNodes(n);
+        engine.threads.set(threadCount);
+        engine.tt.applyNumaPolicy();
+        Search::clear(engine);
+        uint64_t nodes=0;
+        TimePoint elapsed=now();
+        for (const string& fen : defaults){
+          istringstream posIs("fen "+fen);
+          position(engine,pos,posIs,states);
+          istringstream goIs("movetime "+std::to_string(movetime));
+          go(engine,pos,goIs,states);
+          engine.threads.main()->waitForSearchFinished();
+          nodes+=engine.threads.nodesSearched();
+        }
+        elapsed=now()-elapsed+1;
+        cout<<"\nNodes used : "<<n
+          <<"\nThreads    : "<<threadCount
+          <<"\nNPS        : "<<1000*nodes/elapsed<<endl;
+      }
+      Numa::setPolicy(policy);
+      Numa::setActiveNodes(Numa::nodeCount());
+      engine.threads.set(std::max<size_t>(1,engine.options["Threads"].asSize()));
+      engine.tt.applyNumaPolicy();
+    }
+
+    // Lazy SMP scaling over 1, 2, 4 ... n threads at a fixed hash and
+    // movetime. Time to depth is measured against the depth the single thread
+    // run completed on each position. The share of the probes missed by one
+    // thread that hit with n threads is taken as the duplicated work.
+    void benchScale(Engine& engine, Position& pos, istringstream& is, StateListPtr& states){
+      size_t maxThreads=std::max(1u,std::thread::hardware_concurrency()), hashMb=64;
+      TimePoint movetime=1000;
+      is>>maxThreads>>hashMb>>movetime;
+      maxThreads=std::max<size_t>(1,maxThreads);
+      const auto onPv=engine.onPv;
+      const auto onBestMove=engine.onBestMove;
+      engine.onBestMove=[](const Position&, Move, Move){};
+      vector<Depth> target(defaults.size());
+      double baseNps=0, baseTtd=0;
+      double baseHitRate=0;
+      for (size_t n=1;; n=std::min(2*n,maxThreads)){
+        // set resizes the table to the Hash option
+        engine.threads.set(n);
+        engine.tt.resize(std::max<size_t>(1,hashMb));
+        Search::clear(engine);
+        uint64_t nodes=0, ttProbes=0, ttHits=0;
+        TimePoint elapsed=0, ttd=0;
+        double depth=0;
+        for (size_t i=0; i<defaults.size(); ++i){
+          TimePoint reached[maxPly+1]={};
+          const TimePoint start=now();
+          engine.onPv=[&](const Position&, const Depth d){
+            if (!engine.threads.stop&&d<=maxPly&&!reached[d])
+              reached[d]=now()-start+1;
+          };
+          istringstream posIs("fen "+defaults[i]);
+          position(engine,pos,posIs,states);
+          istringstream goIs("movetime "+std::to_string(movetime));
+          go(engine,pos,goIs,states);
+          engine.threads.main()->waitForSearchFinished();
+          const TimePoint t=now()-start+1;
+          elapsed+=t;
+          nodes+=engine.threads.nodesSearched();
+          ttProbes+=engine.threads.ttProbes();
+          ttHits+=engine.threads.ttHits();
+          depth+=engine.threads.main()->completedDepth;
+          if (n==1)
+            target[i]=engine.threads.main()->completedDepth;
+          const auto it=std::find_if(reached+target[i],reached+maxPly+1,[](const TimePoint r){ return r!=0; });
+          ttd+=it!=reached+maxPly+1?*it:t;
+        }
+        const double nps=1000.0*nodes/elapsed;
+        if (n==1){
+          baseNps=nps;
+          baseTtd=double(ttd);
+        }
+        cout<<"\nThreads     : "<<n
+          <<"\nNPS         : "<<uint64_t(nps)
+          <<"\nNPS scaling : "<<nps/baseNps
+          <<"\nTTD scaling : "<<baseTtd/ttd
+          <<"\nAvg depth   : "<<depth/defaults.size();
+        const double hitRate=ttProbes?double(ttHits)/ttProbes:0;
+        if (n==1)
+          baseHitRate=hitRate;
+        cout<<"\nTT hit rate : "<<100*hitRate<<'%'
+          <<"\nDuplication : "<<(baseHitRate<1?100*std::max(0.0,hitRate-baseHitRate)/(1-baseHitRate):0)<<'%';
+        cout<<endl;
+        if (n==maxThreads)
+          break;
+      }
+      engine.onPv=onPv;
+      engine.onBestMove=onBestMove;
+      engine.threads.set(std::max<size_t>(1,engine.options["Threads"].asSize()));
+      Search::clear(engine);
+    }
+
+    // The main thread finishes a depth 1 search and then sits in ponder mode,
+    // so the reported rate is what the helpers get while the GUI ponders.
+    void ponderBench(Engine& engine, Position& pos, istringstream& is, StateListPtr& states){
+      size_t threadCount=std::max<size_t>(2,std::thread::hardware_concurrency());
+      TimePoint movetime=500;
+      is>>threadCount>>movetime;
+      engine.threads.set(std::max<size_t>(2,threadCount));
+      Search::clear(engine);
+      uint64_t helperNodes=0, nodes=0;
+      TimePoint elapsed=now();
+      for (const string& fen : defaults){
+        istringstream posIs("fen "+fen);
+        position(engine,pos,posIs,states);
+        istringstream goIs("ponder depth 1");
+        go(engine,pos,goIs,states);
+        std::this_thread::sleep_for(std::chrono::milliseconds(movetime));
+        engine.threads.stop=true;
+        engine.threads.main()->wake();
+        engine.threads.main()->waitForSearchFinished();
+        nodes+=engine.threads.nodesSearched();
+        helperNodes+=engine.threads.nodesSearched()-engine.threads.main()->nodes;
+      }
+      elapsed=now()-elapsed+1;
+      cout<<"\nThreads    : "<<engine.threads.size()
+        <<"\nHelper NPS : "<<1000*helperNodes/elapsed
+        <<"\nTotal NPS  : "<<1000*nodes/elapsed<<endl;
+      engine.threads.set(std::max<size_t>(1,engine.options["Threads"].asSize()));
+    }
+
+    // Scores every FEN of a file with the batched evaluation, split over the
+    // given number of pool threads, at most Threads. Lines that are not a valid
+    // FEN are reported and skipped. With an output file the scores are written
+    // there in centipawns, one per valid line in input order.
+    void evalBatch(Engine& engine, istringstream& is){
+      string file, outFile;
+      size_t threadCount=engine.options["Threads"].asSize();
+      is>>file>>threadCount>>outFile;
+      ifstream in(file);
+      if (!in){
+        async()<<"info string unable to open "<<file<<std::endl;
+        return;
+      }
+      vector<string> fens;
+      size_t lineNumber=0;
+      for (string line; getline(in,line);){
+        ++lineNumber;
+        if (line.empty())
+          continue;
+        if (Position::validFen(line))
+          fens.emplace_back(line);
+        else
+          async()<<"info string line "<<lineNumber<<" invalid fen "<<line<<std::endl;
       }
+      threadCount=std::clamp<size_t>(threadCount,1,std::clamp<size_t>(fens.size(),1,engine.threads.size()));
+      engine.threads.main()->waitForSearchFinished();
+      vector<Value> scores(fens.size());
+      TimePoint elapsed=now();
+      for (size_t t=0; t<threadCount; ++t){
+        Thread* th=engine.threads[t];
+        th->optimism[WHITE]=th->optimism[BLACK]=VALUE_ZERO;
+        th->runCustomJob([&,t,th]{
+          constexpr size_t chunkSize=1024;
+          const size_t begin=fens.size()*t/threadCount, end=fens.size()*(t+1)/threadCount;
+          vector<Position> positions(chunkSize);
+          vector<StateInfo> states(chunkSize);
+          vector<const Position*> batch(chunkSize);
+          for (size_t first=begin; first<end; first+=chunkSize){
+            const size_t n=std::min(chunkSize,end-first);
+            for (size_t i=0; i<n; ++i)
+              batch[i]=&positions[i].set(fens[first+i],false,&states[i],th);
+            Eval::evaluate(batch.data(),n,&scores[first]);
+          }
+        });
+      }
+      for (size_t t=0; t<threadCount; ++t)
+        engine.threads[t]->waitForSearchFinished();
       elapsed=now()-elapsed+1;
-      cout<<"\nTime (ms) : "<<elapsed
+      if (!outFile.empty()){
+        ofstream out(outFile);
+        for (const Value v : scores)
+          out<<v*100/PawnValueEg<<'\n';
+      }
+      cout<<"\nPositions : "<<fens.size()
+        <<"\nThreads   : "<<threadCount
+        <<"\nTime (ms) : "<<elapsed
+        <<"\nEvals/s   : "<<1000*fens.size()/elapsed<<endl;
+    }
+
+    // EPD lines carry four FEN fields and then operations, of which only id
+    // is kept. Plain FEN lines are taken as they are.
+    bool parseEpd(const string& line, string& fen, string& id){
+      istringstream ss(line);
+      string field[6];
+      for (int i=0; i<4; ++i)
+        if (!(ss>>field[i]))
+          return false;
+      fen=field[0]+" "+field[1]+" "+field[2]+" "+field[3];
+      id.clear();
+      if (ss>>field[4]>>field[5]&&ranges::all_of(field[4]+field[5],::isdigit))
+        fen+=" "+field[4]+" "+field[5];
+      else if (const size_t p=line.find("id \""); p!=string::npos)
+        id=line.substr(p+4,line.find('"',p+4)-p-4);
+      return true;
+    }
+
+    // Searches every position of an EPD or FEN file with a pool of single
+    // threaded engines, each with its own hash and histories:
+    //   analyze <file> [workers n] [hash mb] [out file] [depth n] [nodes n] [movetime ms] [clear]
+    // The file is read as the workers ask for positions and results are
+    // written as they complete, one line each, tagged with the position
+    // number. A worker keeps its hash and histories from one position to
+    // the next. With clear every search starts from a cleared engine, so a
+    // line only depends on its position and the limits, not on the number
+    // of workers.
+    void analyze(Engine& engine, istringstream& is){
+      string file, outFile, token;
+      size_t workerCount=std::max(1u,std::thread::hardware_concurrency());
+      size_t hashMb=engine.options["Hash"].asSize();
+      bool clear=false;
+      Search::LimitsType limits;
+      is>>file;
+      while (is>>token)
+        if (token=="clear") clear=true;
+        else if (token=="workers") is>>workerCount;
+        else if (token=="hash") is>>hashMb;
+        else if (token=="out") is>>outFile;
+        else if (token=="depth") is>>limits.depth;
+        else if (token=="nodes") is>>limits.nodes;
+        else if (token=="movetime") is>>limits.movetime;
+      if (!limits.depth&&!limits.nodes&&!limits.movetime)
+        limits.depth=10;
+      ifstream in(file);
+      ofstream outStream;
+      if (!outFile.empty())
+        outStream.open(outFile);
+      if (!in||(!outFile.empty()&&!outStream)){
+        async()<<"info string unable to open "<<(in?outFile:file)<<std::endl;
+        return;
+      }
+      engine.threads.main()->waitForSearchFinished();
+      std::mutex inMutex, outMutex;
+      size_t count=0;
+      uint64_t nodes=0;
+      const auto write=[&](const string& line, const uint64_t n){
+        const std::scoped_lock lk(outMutex);
+        nodes+=n;
+        if (outFile.empty())
+          async()<<line<<std::endl;
+        else
+          outStream<<line<<std::endl;
+      };
+      vector<std::unique_ptr<Engine>> engines;
+      for (size_t i=0; i<std::max<size_t>(1,workerCount); ++i){
+        engines.emplace_back(std::make_unique<Engine>());
+        engines.back()->tt.resize(std::max<size_t>(1,hashMb));
+        engines.back()->onPv=[](const Position&, Depth){};
+      }
+      vector<std::thread> workers;
+      TimePoint elapsed=now();
+      for (const auto& e : engines)
+        workers.emplace_back([&,worker=e.get()]{
+          Move best=MOVE_NONE;
+          worker->onBestMove=[&best](const Position&, const Move m, Move){ best=m; };
+          MainThread* main=worker->threads.main();
+          for (string line, fen, id;;){
+            size_t n;
+            {
+              const std::scoped_lock lk(inMutex);
+              do
+                if (!getline(in,line))
+                  return;
+              while (line.empty()||line[0]=='#'||!parseEpd(line,fen,id));
+              n=++count;
+            }
+            ostringstream ss;
+            ss<<n;
+            if (!id.empty())
+              ss<<" id "<<id;
+            if (!Position::validFen(fen)){
+              ss<<" error invalid fen";
+              write(ss.str(),0);
+              continue;
+            }
+            StateListPtr states=std::make_unique<std::deque<StateInfo>>(1);
+            Position pos;
+            pos.set(fen,false,&states->back(),main);
+            if (!MoveList<LEGAL>(pos).size()){
+              ss<<" bestmove 0000 score "<<(pos.checkers()?"mate 0":"cp 0")<<" depth 0 nodes 0 pv";
+              write(ss.str(),0);
+              continue;
+            }
+            if (clear)
+              Search::clear(*worker);
+            Search::LimitsType jobLimits=limits;
+            jobLimits.startTime=now();
+            best=MOVE_NONE;
+            worker->threads.startThinking(pos,states,jobLimits,false);
+            main->waitForSearchFinished();
+            const Search::RootMove& rm=main->rootMoves[0];
+            const Value v=rm.score!=-VALUE_INFINITE?rm.score:rm.previousScore;
+            ss<<" bestmove "<<Uci::move(best,false)
+              <<" score "<<Uci::value(v)
+              <<" depth "<<main->completedDepth
+              <<" nodes "<<worker->threads.nodesSearched()
+              <<" pv";
+            for (const Move m : rm.pv)
+              ss<<" "<<Uci::move(m,false);
+            write(ss.str(),worker->threads.nodesSearched());
+          }
+        });
+      for (std::thread& worker : workers)
+        worker.join();
+      elapsed=now()-elapsed+1;
+      cout<<"\nPositions : "<<count
+        <<"\nWorkers   : "<<engines.size()
+        <<"\nTime (ms) : "<<elapsed
         <<"\nNodes     : "<<nodes
         <<"\nNPS       : "<<1000*nodes/elapsed<<endl;
     }
+
+    void hashFile(Engine& engine, istringstream& is, const bool save){
+      string file;
+      getline(is>>ws,file);
+      if (file.empty())
+        async()<<"info string missing file name"<<std::endl;
+      else if (save?engine.tt.save(file):engine.tt.load(file))
+        async()<<"info string hash "<<(save?"saved to ":"loaded from ")<<file<<std::endl;
+      else
+        async()<<"info string failed to "<<(save?"save hash to ":"load hash from ")<<file<<std::endl;
+    }
+
+    // Writes the network in use in the mapped format, see Eval::Nnue::loadMapped
+    void exportNet(istringstream& is){
+      string file;
+      getline(is>>ws,file);
+      file.erase(file.find_last_not_of(' ')+1);
+      if (file.empty())
+        async()<<"info string missing file name"<<std::endl;
+      else if (Eval::Nnue::exportMapped(file))
+        async()<<"info string mapped network for "<<Eval::Nnue::targetName()<<" written to "<<file<<std::endl;
+      else
+        async()<<"info string failed to write network to "<<file<<std::endl;
+    }
+
+    // Checks every network code path this CPU runs against the scalar
+    // reference: nnuecheck [fenFile] [calls]. For each position of the file,
+    // or of the bench by default, a path evaluates the position from a
+    // cleared accumulator stack and cache, then every legal move from it
+    // with an incremental update, and finally all positions in one batch.
+    // Values and complexities must be identical. Then the layers of every
+    // path are timed on the first position, in ns per call. Returns false
+    // on a mismatch or when the check could not run.
+    bool nnueCheck(Engine& engine, istringstream& is){
+      using namespace Eval::Nnue;
+      string fenFile="default";
+      int calls=100000;
+      is>>fenFile>>calls;
+      vector<string> fens=defaults;
+      if (fenFile!="default"){
+        ifstream in(fenFile);
+        if (!in){
+          async()<<"info string unable to open "<<fenFile<<std::endl;
+          return false;
+        }
+        fens.clear();
+        for (string line; getline(in,line);)
+          if (!line.empty())
+            fens.emplace_back(line);
+      }
+      const vector<const Target*> paths=targets();
+      vector<const Target*> all{&Targets::scalar};
+      all.insert(all.end(),paths.begin(),paths.end());
+      for (const Target* t : all)
+        if (t!=paths[0]&&!loadInto(*t)){
+          async()<<"info string unable to load the network into "<<t->name()<<std::endl;
+          return false;
+        }
+      MainThread* main=engine.threads.main();
+      main->waitForSearchFinished();
+      const size_t n=fens.size();
+      vector<Position> positions(n);
+      vector<StateInfo> states(n);
+      vector<const Position*> batch(n);
+      for (size_t i=0; i<n; ++i)
+        batch[i]=&positions[i].set(fens[i],false,&states[i],main);
+      struct Result{
+        Value v;
+        int complexity;
+        bool operator==(const Result&) const = default;
+      };
+      // The evaluations of a path in a fixed order, with the position and
+      // move each one belongs to
+      const auto run=[&](const Target& t, vector<pair<size_t, Move>>* where){
+        vector<Result> evals;
+        StateInfo st;
+        int complexity;
+        for (size_t i=0; i<n; ++i){
+          main->accumulators.clear();
+          t.clearCache(main->refreshTable);
+          evals.push_back({t.evaluate(positions[i],false,&complexity),complexity});
+          if (where)
+            where->emplace_back(i,MOVE_NONE);
+          for (const Move m : MoveList<LEGAL>(positions[i])){
+            positions[i].doMove(m,st);
+            evals.push_back({t.evaluate(positions[i],false,&complexity),complexity});
+            positions[i].undoMove(m);
+            if (where)
+              where->emplace_back(i,m);
+          }
+        }
+        vector<Value> values(n);
+        vector<int> complexities(n);
+        t.evaluateBatch(batch.data(),n,values.data(),false,complexities.data());
+        for (size_t i=0; i<n; ++i){
+          evals.push_back({values[i],complexities[i]});
+          if (where)
+            where->emplace_back(i,MOVE_NONE);
+        }
+        return evals;
+      };
+      vector<pair<size_t, Move>> where;
+      const vector<Result> reference=run(Targets::scalar,&where);
+      async()<<"info string nnue reference "<<Targets::scalar.name()<<" positions "<<n
+        <<" evaluations "<<reference.size()<<std::endl;
+      bool matched=true;
+      for (const Target* t : paths){
+        const vector<Result> evals=run(*t,nullptr);
+        size_t mismatches=0, first=evals.size();
+        for (size_t i=0; i<evals.size(); ++i)
+          if (!(evals[i]==reference[i])&&mismatches++==0)
+            first=i;
+        matched&=!mismatches;
+        if (!mismatches)
+          async()<<"info string nnue "<<t->name()<<" matches the reference"<<std::endl;
+        else
+          async()<<"info string nnue "<<t->name()<<" mismatches "<<mismatches
+            <<" first fen "<<fens[where[first].first]
+            <<(where[first].second==MOVE_NONE?string():" move "+Uci::move(where[first].second,false))
+            <<" value "<<evals[first].v<<" expected "<<reference[first].v
+            <<" complexity "<<evals[first].complexity<<" expected "<<reference[first].complexity<<std::endl;
+      }
+      main->accumulators.clear();
+      clearCache(main->refreshTable);
+      for (const Target* t : all){
+        LayerTime times[16];
+        const int count=t->benchLayers(positions[0],calls,times);
+        ostringstream line;
+        line<<"info string nnue layers "<<t->name()<<" ns/call"<<fixed<<setprecision(1);
+        for (int i=0; i<count; ++i)
+          line<<" "<<times[i].name<<" "<<times[i].ns;
+        async()<<line.str()<<std::endl;
+      }
+      return matched;
+    }
+
+    void ttStats(Engine& engine){
+#ifdef USE_TT_VERIFY
+      const TtStats st=engine.threads.ttStats();
+      async()<<"info string tt entry 16 bytes probes "<<st.probes
+        <<" hits "<<st.hits
+        <<" collisions "<<st.collisions
+        <<" torn "<<st.torn<<std::endl;
+#else
+      (void)engine;
+      async()<<"info string tt entry 10 bytes, build with ttverify=yes to count collisions and torn writes"<<std::endl;
+#endif
+    }
+
+    // Sums since the last ucinewgame. The stage counts are the furthest
+    // stage the move picker of a search or qsearch node got to.
+    void searchStats(Engine& engine){
+#ifdef USE_SEARCH_STATS
+      const Search::Stats st=engine.threads.searchStats();
+      async()<<"info string nodes "<<engine.threads.nodesSearched()
+        <<" qsearch "<<st.qsearchNodes<<std::endl;
+      async()<<"info string tt probes "<<st.ttProbes
+        <<" hits "<<st.ttHits
+        <<" cutoffs "<<st.ttCutoffs<<std::endl;
+      async()<<"info string nmp tries "<<st.nmpTries
+        <<" cutoffs "<<st.nmpCutoffs
+        <<" probcut cutoffs "<<st.probCutCutoffs
+        <<" lmr researches "<<st.lmrResearches
+        <<" futility prunes "<<st.futilityPrunes<<std::endl;
+      async()<<"info string nnue refreshes "<<st.nnueRefreshes
+        <<" updates "<<st.nnueUpdates
+        <<" skipped "<<st.nnueSkipped<<std::endl;
+      async()<<"info string stages";
+      for (int i=0; i<MovePicker::stageCount; ++i)
+        async()<<" "<<MovePicker::stageName(i)<<" "<<st.stages[i];
+      async()<<std::endl;
+#else
+      (void)engine;
+      async()<<"info string build with searchstats=yes to count search events"<<std::endl;
+#endif
+    }
   }
 
-  void Uci::loop(const int argc, char* argv[]){
+  int Uci::loop(Engine& engine, const int argc, char* argv[]){
     std::ios::sync_with_stdio(false);
     std::cin.tie(nullptr);
     Position pos;
     string token, cmd;
+    int status=0;
     StateListPtr states(new std::deque<StateInfo>(1));
-    pos.set(startFen,false,&states->back(),threads.main());
+    pos.set(startFen,false,&states->back(),engine.threads.main());
     for (int i=1; i<argc; ++i)
       cmd+=std::string(argv[i])+" ";
     do{
@@ -112,27 +837,46 @@ namespace Nebula{
       token.clear();
       is>>skipws>>token;
       if (token=="quit"
-        ||token=="stop")
-        threads.stop=true;
-      else if (token=="ponderhit")
-        threads.main()->ponder=false;
+        ||token=="stop"){
+        engine.threads.stop=true;
+        engine.threads.main()->wake();
+      }
+      else if (token=="ponderhit"){
+        engine.threads.main()->ponder=false;
+        engine.threads.main()->wake();
+      }
       else if (token=="uci")
         async()<<engineInfo()
-          <<options<<"\nuciok"<<std::endl;
-      else if (token=="setoption") setoption(is);
-      else if (token=="go") go(pos,is,states);
-      else if (token=="position") position(pos,is,states);
-      else if (token=="ucinewgame") Search::clear();
+          <<engine.options<<"\nuciok"<<std::endl;
+      else if (token=="setoption") setoption(engine,is);
+      else if (token=="go") go(engine,pos,is,states);
+      else if (token=="position") position(engine,pos,is,states);
+      else if (token=="ucinewgame") Search::clear(engine);
       else if (token=="isready") async()<<"readyok"<<std::endl;
-      else if (token=="bench") bench(pos,states);
+      else if (token=="bench") bench(engine,pos,is,states);
+      else if (token=="numabench") numaBench(engine,pos,is,states);
+      else if (token=="ponderbench") ponderBench(engine,pos,is,states);
+      else if (token=="benchscale") benchScale(engine,pos,is,states);
+      else if (token=="ttstats") ttStats(engine);
+      else if (token=="searchstats") searchStats(engine);
+      else if (token=="evalbatch") evalBatch(engine,is);
+      else if (token=="analyze") analyze(engine,is);
+      else if (token=="savehash") hashFile(engine,is,true);
+      else if (token=="loadhash") hashFile(engine,is,false);
+      else if (token=="exportnet") exportNet(is);
+      else if (token=="nnuecheck") status|=!nnueCheck(engine,is);
       else if (token=="perft"){
         int d=1;
+        size_t hashMb=0;
         is>>d;
+        if (is>>token&&token=="hash")
+          is>>hashMb;
         d=std::max(d,1);
-        perft(pos,d);
+        perft(engine,pos,d,hashMb);
       }
     }
     while (token!="quit"&&argc==1);
+    return status;
   }
 
   string Uci::value(const Value v){
@@ -1,10 +1,12 @@
 #pragma once
+#include <functional>
 #include <map>
 #include <string>
 #include "search.h"
 #include "types.h"
 
 namespace Nebula{
+  class Engine;
   class Position;
 
   namespace Uci{
@@ -18,7 +20,7 @@ namespace Nebula{
 
     class Option{
     public:
-      using OnChange = void(*)(const Option&);
+      using OnChange = std::function<void(const Option&)>;
 
       explicit Option(const OnChange f=nullptr)
         : type("string"), min(0), max(0), on_change(f){}
@@ -59,6 +61,8 @@ namespace Nebula{
       [[nodiscard]] double asDouble() const{ return std::stod(currentValue); }
       [[nodiscard]] const std::string& asString() const{ return currentValue; }
       bool operator==(const char* s) const{ return currentValue==s; }
+      // Takes a value changed from elsewhere, without calling on_change
+      void sync(const std::string& v){ currentValue=v; }
     private:
       friend std::ostream& operator<<(std::ostream&, const OptionsMap&);
       std::string defaultValue;
@@ -68,14 +72,16 @@ namespace Nebula{
       OnChange on_change;
     };
 
-    void init(OptionsMap&);
-    void loop(int argc, char* argv[]);
+    void init(OptionsMap&, Engine& engine);
+    // Another engine of the process may have replaced the network since,
+    // EvalFile is set to the one in use.
+    void syncEvalFile(OptionsMap& o);
+    // Returns non-zero when a check such as nnuecheck failed
+    int loop(Engine& engine, int argc, char* argv[]);
     std::string value(Value v);
     std::string square(Square s);
     std::string move(Move m, bool chess960);
     std::string pv(const Position& pos, Depth depth);
     Move toMove(const Position& pos, std::string& str);
   }
-
-  extern Uci::OptionsMap options;
 }
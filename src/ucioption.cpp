@@ -1,17 +1,51 @@
 #include <algorithm>
+#include "engine.h"
+#include "evaluate.h"
 #include "misc.h"
-#include "thread.h"
-#include "tt.h"
+#include "numa.h"
 #include "uci.h"
 using std::string;
 
 namespace Nebula{
-  Uci::OptionsMap options;
-
   namespace Uci{
     namespace{
-      void onHashSize(const Option& o){ tt.resize(std::max<size_t>(1,o.asSize())); }
-      void onThreads(const Option& o){ threads.set(std::max<size_t>(1,o.asSize())); }
+      void onHashSize(Engine& engine, const Option& o){
+        engine.tt.resize(std::max<size_t>(1,o.asSize()));
+        engine.onMessage("Hash "+std::to_string(o.asSize())+" MB using "+pageModeName(engine.tt.pageMode()));
+      }
+
+      void onThreads(Engine& engine, const Option& o){ engine.threads.set(std::max<size_t>(1,o.asSize())); }
+
+      void onNumaPolicy(Engine& engine, const Option& o){
+        Numa::setPolicy(o=="bind"
+                        ?NumaPolicy::Bind
+                        :o=="interleave"
+                        ?NumaPolicy::Interleave
+                        :NumaPolicy::None);
+        engine.threads.set(std::max<size_t>(1,engine.options["Threads"].asSize()));
+        engine.tt.applyNumaPolicy();
+        engine.onMessage(Numa::info()+" policy "+o.asString());
+      }
+
+      // The network is shared by every engine of the process, so it is kept
+      // while any of them is searching. The threads of the other engines drop
+      // their caches when they next run, see Thread::syncNetwork.
+      void onEvalFile(Engine& engine, const Option& o){
+        engine.threads.main()->waitForSearchFinished();
+        std::unique_lock network(Eval::Nnue::networkMutex,std::try_to_lock);
+        if (!network){
+          engine.onMessage("an engine is searching, keeping "+Eval::currentNnueNetName);
+          return;
+        }
+        const bool loaded=Eval::Nnue::init(o.asString());
+        network.unlock();
+        if (loaded){
+          Search::clear(engine);
+          engine.onMessage("NNUE evaluation using "+Eval::currentNnueNetName);
+        }
+        else
+          engine.onMessage("failed to load "+o.asString()+", keeping "+Eval::currentNnueNetName);
+      }
     }
 
     bool CaseInsensitiveLess::operator()(const string& s1, const string& s2) const{
@@ -19,12 +53,23 @@ namespace Nebula{
         [](const char c1, const char c2){ return tolower(c1)<tolower(c2); });
     }
 
-    void init(OptionsMap& o){
+    void init(OptionsMap& o, Engine& engine){
       constexpr int maxHashMb=is64Bit?33554432:2048;
-      o["Threads"]<<Option(1,1,512,onThreads);
-      o["Hash"]<<Option(16,1,maxHashMb,onHashSize);
+      o["Threads"]<<Option(1,1,512,[&engine](const Option& v){ onThreads(engine,v); });
+      o["Hash"]<<Option(16,1,maxHashMb,[&engine](const Option& v){ onHashSize(engine,v); });
       o["MultiPV"]<<Option(1,1,500);
       o["Ponder"]<<Option(false);
+      o["BackgroundClear"]<<Option(false);
+      o["EvalCache"]<<Option(false);
+      o["NumaPolicy"]<<Option("none var none var bind var interleave","none",
+        [&engine](const Option& v){ onNumaPolicy(engine,v); });
+      o["EvalFile"]<<Option(NnueNetDefaultName,[&engine](const Option& v){ onEvalFile(engine,v); });
+    }
+
+    void syncEvalFile(OptionsMap& o){
+      std::shared_lock network(Eval::Nnue::networkMutex);
+      if (!Eval::currentNnueNetName.empty())
+        o["EvalFile"].sync(Eval::currentNnueNetName);
     }
 
     std::ostream& operator<<(std::ostream& os, const OptionsMap& om){